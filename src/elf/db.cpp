@@ -58,6 +58,7 @@ static const int THREAD_NUM_DEFAULT = 5;
 //static THREAD_MAP s_threads;
 //static xqueue<query_t *> s_queue_req[THREAD_NUM];
 static xqueue<query_t *> s_queue_res;
+static MYSQL *s_escape = NULL; // for escaping only, never connected
 
 static void *handle(void *args);
 static void query(mysql_thread_t *th);
@@ -220,6 +221,10 @@ int db_fini(void)
         E_DELETE th_list;
     }
     s_threads.clear();
+    if (s_escape) {
+        mysql_close(s_escape);
+        s_escape = NULL;
+    }
     return ELF_RC_DB_OK;
 }
 
@@ -358,6 +363,27 @@ void response(query_t *q)
     destroy(q);
 }
 
+void db_escape(const std::string &val, std::string *out)
+{
+    assert(out);
+
+    if (s_escape == NULL) {
+        s_escape = mysql_init(NULL);
+    }
+
+    size_t pos = out->size() + 1;
+
+    // 2 bytes per char at most, and the terminator
+    out->resize(pos + val.size() * 2 + 1);
+    (*out)[pos - 1] = '\'';
+
+    unsigned long len = mysql_real_escape_string(s_escape, &(*out)[pos],
+            val.data(), val.size());
+
+    out->resize(pos + len);
+    out->push_back('\'');
+}
+
 size_t db_pending_size(int idx)
 {
     size_t sum = 0;
@@ -95,6 +95,13 @@ void db_req(int idx, const char *cmd, bool parallel = false, db_callback proc =
 /// @return Size of pending request queues.
 ///
 size_t db_pending_size(int idx);
+
+///
+/// Escape string value by the client library as a quoted SQL literal.
+/// @param[in] val String value.
+/// @param[out] out Quoted literal, appended.
+///
+void db_escape(const std::string &val, std::string *out);
 } // namespace elf
 
 #endif /* !ELF_DB_H */
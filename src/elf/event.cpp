@@ -4,22 +4,81 @@
  */
 
 #include <elf/event.h>
+#include <elf/lock.h>
 #include <elf/log.h>
 #include <elf/memory.h>
-#include <map>
-#include <set>
+#include <elf/thread.h>
+#include <elf/time.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <vector>
 
 namespace elf {
-typedef std::map<oid_t, callback_t *> callback_list;
-typedef std::map<oid_t, callback_list *> listener_list;
-typedef std::map<int, listener_list *> listener_map;
+#define INDEX_SIZE_MIN 64 // power of 2
+#define EVENT_RANGE_MAX 65536
+#define QUEUE_SIZE_MIN 1024 // power of 2
+#define INGRESS_SIZE 4096 // power of 2
+#define INGRESS_BATCH 1024 // max operations drained per producer per frame
+#define CACHE_LINE_SIZE 64
 
-static listener_map s_listeners;
+// listeners of (evt, oid)
+struct listener_t {
+    int evt;
+    oid_t oid; // OID_NIL if any
+    bool any; // listening to all owners
+    int dead; // number of tombstones
+    std::vector<callback_t> cbs; // tombstone if func is NULL
+};
+
+// slot of open addressing hash index
+struct slot_t {
+    int evt;
+    oid_t oid;
+    int idx; // -1 if empty
+};
+
+// (evt, oid) -> idx, linear probing
+struct index_t {
+    slot_t *slots;
+    int cap;
+    int size;
+};
+
+static index_t s_index; // (evt, oid) -> s_listeners
+static index_t s_owners; // (0, oid) -> s_owner_lists
+static index_t s_any_index; // (evt, OID_NIL) -> s_listeners of any oid
+static index_t s_merges; // (evt, oid) -> position of emission kept, per frame
+static std::vector<unsigned char> s_policies; // event_coalesce of events
+static int s_policy_num; // number of events coalesced
+
+// profile of listeners with the same (evt, ltype)
+struct prof_t {
+    int evt;
+    int ltype;
+    uint64_t calls; // sampled calls
+    uint64_t cost; // total callback time(us)
+    uint64_t cost_max;
+    uint64_t resid; // total time from emitted to dispatched(us)
+    uint64_t resid_max;
+};
+
+static int s_sample; // profile 1 of s_sample emissions, 0 if disabled
+static unsigned int s_sample_seed = 2463534242U; // xorshift, raced by threads
+static index_t s_prof_index; // (evt, ltype) -> s_profs
+static std::vector<prof_t> s_profs;
+static std::vector<listener_t *> s_listeners; // NULL if free
+static std::vector<int> s_free_listeners;
+static std::vector<std::vector<int> *> s_owner_lists; // listeners of oid
+static std::vector<int> s_free_owners;
+static std::vector<int> s_dirty; // listeners with tombstones
 
 enum event_oper {
     EVENT_OPER_REGIST,
     EVENT_OPER_UNREGIST,
     EVENT_OPER_EMIT,
+    EVENT_OPER_REGIST_ANY, // evt to arg_a
+    EVENT_OPER_UNREGIST_ANY,
+    EVENT_OPER_COALESCED, // emission merged into another one
 };
 
 struct event_oper_t {
@@ -30,6 +89,7 @@ struct event_oper_t {
     oid_t oid;
     oid_t lid;
     callback_t *cb;
+    time64_t time; // emitted time(us), 0 if not profiling
 
     event_oper_t(int e, callback_t *c) :
         oper(EVENT_OPER_REGIST),
@@ -38,7 +98,8 @@ struct event_oper_t {
         arg_b(0),
         oid(OID_NIL),
         lid(OID_NIL),
-        cb(c)
+        cb(c),
+        time(0)
     {
     }
 
@@ -49,7 +110,8 @@ struct event_oper_t {
         arg_b(0),
         oid(o),
         lid(l),
-        cb(NULL)
+        cb(NULL),
+        time(0)
     {
     }
 
@@ -60,210 +122,935 @@ struct event_oper_t {
         arg_b(b),
         oid(o),
         lid(OID_NIL),
-        cb(NULL)
+        cb(NULL),
+        time(0)
     {
     }
 };
 
-static std::list<event_oper_t *> s_ops;
+// growable ring buffer of operations
+struct oper_queue_t {
+    event_oper_t *ops;
+    int cap; // power of 2
+    int head;
+    int size;
+};
+
+// SPSC ring of operations from one non-main thread
+struct ingress_t {
+    int head __attribute__((aligned(CACHE_LINE_SIZE))); // by event_proc
+    int tail __attribute__((aligned(CACHE_LINE_SIZE))); // by producer
+    bool spilled; // spill is not empty, set by producer
+    bool exited; // producer thread exited, freed once drained
+    event_oper_t *ops; // INGRESS_SIZE
+    std::vector<event_oper_t> *spill; // the ring is full
+    size_t spill_head; // spilled ones drained, by event_proc
+    spin_t lock; // lock of spill
+    ingress_t *next;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
 
-static void regist(int evt, callback_t *cb)
+static oper_queue_t s_queues[2]; // double buffered
+static int s_cur; // queue pushed into, the other one is processing
+static thread_t s_owner; // thread calling event_proc
+static pthread_key_t s_ingress_key; // ingress of current thread
+static ingress_t *s_ingresses; // all ingresses
+
+static inline unsigned int index_hash(int evt, oid_t oid)
 {
-    assert(cb);
-    callback_list *cl = NULL;
-    listener_list *ll = NULL;
-    listener_map::iterator itr = s_listeners.find(evt);
+    uint64_t h = (uint64_t)oid * 0x9e3779b97f4a7c15ULL
+        ^ (uint64_t)(unsigned int)evt * 0xc2b2ae3d27d4eb4fULL;
 
-    if (itr == s_listeners.end()) {
-        ll = E_NEW listener_list;
-        s_listeners[evt] = ll;
-    } else {
-        ll = itr->second;
+    return (unsigned int)(h ^ (h >> 32));
+}
+
+static void index_init(index_t *idx, int cap)
+{
+    idx->slots = (slot_t *)E_ALLOC(sizeof(slot_t) * cap);
+    idx->cap = cap;
+    idx->size = 0;
+    for (int i = 0; i < cap; ++i) {
+        idx->slots[i].idx = -1;
     }
+}
+
+static void index_fini(index_t *idx)
+{
+    E_FREE(idx->slots);
+    idx->cap = idx->size = 0;
+}
 
-    listener_list::iterator itr_l = ll->find(cb->oid);
-    callback_list::iterator itr_c;
+///
+/// Find slot of given key.
+/// @return Slot position, or the empty slot to insert.
+///
+static inline int index_slot(const index_t *idx, int evt, oid_t oid)
+{
+    unsigned int mask = idx->cap - 1;
+    unsigned int pos = index_hash(evt, oid) & mask;
 
-    if (itr_l == ll->end()) {
-        cl = E_NEW callback_list;
-        (*ll)[cb->oid] = cl;
-    } else {
-        cl = itr_l->second;
-    }
-    itr_c = cl->find(cb->lid);
-    if (itr_c != cl->end()) {
-        LOG_WARN("event", "<%lld><%lld> regist event %d (%d) ALREADY.",
-                cb->oid, cb->lid, evt, cb->larg);
-        E_FREE(cb);
-    } else {
-        (*cl)[cb->lid] = cb;
-        LOG_TRACE("event", "<%lld><%lld> regist event %d (%d).",
-                cb->oid, cb->lid, evt, cb->larg);
+    while (idx->slots[pos].idx >= 0) {
+        const slot_t &s = idx->slots[pos];
+
+        if (s.evt == evt && s.oid == oid) {
+            break;
+        }
+        pos = (pos + 1) & mask;
     }
+    return pos;
 }
 
-static void unregist(int evt, oid_t oid, oid_t lid)
+///
+/// Find value of given key.
+/// @return Value, -1 if not found.
+///
+static inline int index_find(const index_t *idx, int evt, oid_t oid)
 {
-    LOG_TRACE("event", "<%lld> <%lld> unregist event %d.",
-            oid, lid, evt);
-    if (evt > 0) {
-        listener_map::iterator itr = s_listeners.find(evt);
+    return idx->slots[index_slot(idx, evt, oid)].idx;
+}
 
-        if (itr == s_listeners.end()) {
-            LOG_WARN("event", "<%lld> has NO event %d.",
-                    oid, evt);
-            return;
+static void index_insert(index_t *idx, int evt, oid_t oid, int val)
+{
+    if ((idx->size + 1) * 4 > idx->cap * 3) { // load factor 0.75
+        index_t n;
+
+        index_init(&n, idx->cap * 2);
+        for (int i = 0; i < idx->cap; ++i) {
+            const slot_t &s = idx->slots[i];
+
+            if (s.idx >= 0) {
+                n.slots[index_slot(&n, s.evt, s.oid)] = s;
+            }
         }
+        n.size = idx->size;
+        index_fini(idx);
+        *idx = n;
+    }
 
-        listener_list *ll = itr->second;
+    slot_t &s = idx->slots[index_slot(idx, evt, oid)];
 
-        assert(ll);
-        listener_list::iterator itr_l = ll->find(oid);
+    if (s.idx < 0) {
+        ++idx->size;
+    }
+    s.evt = evt;
+    s.oid = oid;
+    s.idx = val;
+}
 
-        if (itr_l != ll->end()) {
-            callback_list *cl = itr_l->second;
-            callback_list::iterator itr_c = cl->begin();
+///
+/// Erase key, following slots are shifted back to keep probing chains.
+///
+static void index_erase(index_t *idx, int evt, oid_t oid)
+{
+    unsigned int mask = idx->cap - 1;
+    unsigned int pos = index_slot(idx, evt, oid);
 
-            while (itr_c != cl->end()) {
-                callback_t *cb = itr_c->second;
+    if (idx->slots[pos].idx < 0) {
+        return;
+    }
+    --idx->size;
 
-                if (lid == OID_NIL || lid == cb->lid) {
-                    E_FREE(cb);
-                    cl->erase(itr_c++);
-                } else {
-                    ++itr_c;
-                }
+    unsigned int next = pos;
+
+    for (;;) {
+        idx->slots[pos].idx = -1;
+        for (;;) {
+            next = (next + 1) & mask;
+
+            const slot_t &s = idx->slots[next];
+
+            if (s.idx < 0) {
+                return;
             }
-            if (cl->empty()) {
-                E_DELETE(cl);
-                ll->erase(itr_l);
+
+            unsigned int home = index_hash(s.evt, s.oid) & mask;
+
+            // move back if home is not in (pos, next]
+            if ((next > pos && (home <= pos || home > next))
+                    || (next < pos && (home <= pos && home > next))) {
+                break;
             }
         }
-    } else {
-        listener_map::iterator itr = s_listeners.begin();
+        idx->slots[pos] = idx->slots[next];
+        pos = next;
+    }
+}
 
-        for (; itr != s_listeners.end(); ++itr) {
-            listener_list *ll = itr->second;
+static void queue_init(oper_queue_t *q, int cap)
+{
+    q->ops = (event_oper_t *)E_ALLOC(sizeof(event_oper_t) * cap);
+    q->cap = cap;
+    q->head = 0;
+    q->size = 0;
+}
 
-            assert(ll);
-            listener_list::iterator itr_l = ll->find(oid);
+static void queue_fini(oper_queue_t *q)
+{
+    E_FREE(q->ops);
+    q->cap = q->head = q->size = 0;
+}
 
-            if (itr_l != ll->end()) {
-                callback_list *cl = itr_l->second;
-                callback_list::iterator itr_c = cl->begin();
+static inline void queue_push(const event_oper_t &op)
+{
+    oper_queue_t *q = s_queues + s_cur;
 
-                while (itr_c != cl->end()) {
-                    callback_t *cb = itr_c->second;
+    if (q->size == q->cap) { // unwrap into doubled buffer
+        event_oper_t *ops = (event_oper_t *)E_ALLOC(
+                sizeof(event_oper_t) * q->cap * 2);
+        int n = q->cap - q->head;
 
-                    if (lid == OID_NIL || lid == cb->lid) {
-                        E_FREE(cb);
-                        cl->erase(itr_c++);
-                    } else {
-                        ++itr_c;
-                    }
-                }
-                if (cl->empty()) {
-                    E_DELETE(cl);
-                    ll->erase(itr_l);
-                }
+        memcpy(ops, q->ops + q->head, sizeof(event_oper_t) * n);
+        memcpy(ops + n, q->ops, sizeof(event_oper_t) * q->head);
+        E_FREE(q->ops);
+        q->ops = ops;
+        q->cap *= 2;
+        q->head = 0;
+    }
+    q->ops[(q->head + q->size) & (q->cap - 1)] = op;
+    ++q->size;
+}
+
+static ingress_t *ingress_init(void)
+{
+    void *buf = NULL;
+
+    if (posix_memalign(&buf, CACHE_LINE_SIZE, sizeof(ingress_t)) != 0) {
+        abort();
+    }
+
+    ingress_t *in = (ingress_t *)buf;
+
+    memset(in, 0, sizeof(*in));
+    in->ops = (event_oper_t *)E_ALLOC(sizeof(event_oper_t) * INGRESS_SIZE);
+    in->spill = E_NEW std::vector<event_oper_t>;
+    spin_init(&in->lock);
+    do {
+        in->next = __atomic_load_n(&s_ingresses, __ATOMIC_ACQUIRE);
+    } while (!__sync_bool_compare_and_swap(&s_ingresses, in->next, in));
+    pthread_setspecific(s_ingress_key, in);
+    return in;
+}
+
+///
+/// On producer thread exit, left to event_proc.
+///
+static void ingress_exit(void *args)
+{
+    ingress_t *in = (ingress_t *)args;
+
+    __atomic_store_n(&in->exited, true, __ATOMIC_RELEASE);
+}
+
+///
+/// Remove ingress from the list, by event_proc only.
+///
+static void ingress_unlink(ingress_t *in)
+{
+    if (__sync_bool_compare_and_swap(&s_ingresses, in, in->next)) {
+        return;
+    }
+
+    // producers only insert before the head
+    ingress_t *prev = __atomic_load_n(&s_ingresses, __ATOMIC_ACQUIRE);
+
+    while (prev->next != in) {
+        prev = prev->next;
+    }
+    prev->next = in->next;
+}
+
+static void ingress_fini(ingress_t *in)
+{
+    for (int i = in->head; i != in->tail; ++i) { // not handled
+        event_oper_t &op = in->ops[i & (INGRESS_SIZE - 1)];
+
+        if (op.cb != NULL) {
+            E_FREE(op.cb);
+        }
+    }
+    for (size_t i = in->spill_head; i < in->spill->size(); ++i) {
+        if ((*in->spill)[i].cb != NULL) {
+            E_FREE((*in->spill)[i].cb);
+        }
+    }
+    E_FREE(in->ops);
+    E_DELETE(in->spill);
+    spin_fini(&in->lock);
+    free(in);
+}
+
+///
+/// Push operation from non-main thread, no lock unless the ring is full.
+///
+static void ingress_push(const event_oper_t &op)
+{
+    ingress_t *in = (ingress_t *)pthread_getspecific(s_ingress_key);
+
+    if (in == NULL) {
+        in = ingress_init();
+    }
+
+    int tail = in->tail;
+
+    // keep order after spilled
+    if (!__atomic_load_n(&in->spilled, __ATOMIC_ACQUIRE)
+            && tail - __atomic_load_n(&in->head, __ATOMIC_ACQUIRE)
+            < INGRESS_SIZE) {
+        in->ops[tail & (INGRESS_SIZE - 1)] = op;
+        __atomic_store_n(&in->tail, tail + 1, __ATOMIC_RELEASE);
+        return;
+    }
+
+    spin lock(&in->lock);
+
+    in->spill->push_back(op);
+    __atomic_store_n(&in->spilled, true, __ATOMIC_RELEASE);
+}
+
+///
+/// Move at most INGRESS_BATCH operations of a producer into current queue.
+/// @return true if all drained.
+///
+static bool ingress_drain_one(ingress_t *in)
+{
+    int head = in->head;
+    int tail = __atomic_load_n(&in->tail, __ATOMIC_ACQUIRE);
+    int n = std::min(tail - head, INGRESS_BATCH);
+
+    for (int i = 0; i < n; ++i) {
+        queue_push(in->ops[(head + i) & (INGRESS_SIZE - 1)]);
+    }
+    __atomic_store_n(&in->head, head + n, __ATOMIC_RELEASE);
+    if (head + n != tail) {
+        return false;
+    }
+    if (!__atomic_load_n(&in->spilled, __ATOMIC_ACQUIRE)) {
+        return true;
+    }
+
+    // ring refilled after tail read and then spilled, spill deferred
+    if (__atomic_load_n(&in->tail, __ATOMIC_ACQUIRE) != tail) {
+        return false;
+    }
+
+    // ring drained, spilled ones follow
+    spin lock(&in->lock);
+
+    size_t end = std::min(in->spill->size(),
+            in->spill_head + (INGRESS_BATCH - n));
+
+    for (; in->spill_head < end; ++in->spill_head) {
+        queue_push((*in->spill)[in->spill_head]);
+    }
+    if (in->spill_head < in->spill->size()) {
+        return false;
+    }
+    in->spill->clear();
+    in->spill_head = 0;
+    __atomic_store_n(&in->spilled, false, __ATOMIC_RELEASE);
+    return true;
+}
+
+///
+/// Move operations from non-main threads into current queue, in order of
+/// each producer. Ingresses of exited threads are freed once drained.
+///
+static void ingress_drain(void)
+{
+    ingress_t *in = __atomic_load_n(&s_ingresses, __ATOMIC_ACQUIRE);
+
+    while (in != NULL) {
+        ingress_t *next = in->next;
+        bool exited = __atomic_load_n(&in->exited, __ATOMIC_ACQUIRE);
+
+        if (ingress_drain_one(in) && exited) {
+            ingress_unlink(in);
+            ingress_fini(in);
+        }
+        in = next;
+    }
+}
+
+static void index_clear(index_t *idx)
+{
+    if (idx->size > 0) {
+        for (int i = 0; i < idx->cap; ++i) {
+            idx->slots[i].idx = -1;
+        }
+        idx->size = 0;
+    }
+}
+
+///
+/// Stop merging emissions across listener operation, which changes the
+/// listeners they are delivered to.
+///
+static void coalesce_fence(const event_oper_t &op)
+{
+    switch (op.oper) {
+        case EVENT_OPER_REGIST:
+            index_erase(&s_merges, op.evt, op.cb->oid);
+            break;
+        case EVENT_OPER_UNREGIST:
+            if (op.evt != 0) {
+                index_erase(&s_merges, op.evt, op.oid);
+            } else { // all events of the owner
+                index_clear(&s_merges);
             }
+            break;
+        case EVENT_OPER_REGIST_ANY:
+        case EVENT_OPER_UNREGIST_ANY:
+            index_clear(&s_merges);
+            break;
+        default:
+            break;
+    }
+}
+
+///
+/// Merge emissions with the same (evt, oid) in the queue per policy of the
+/// event, merged ones are marked EVENT_OPER_COALESCED. Emissions separated
+/// by listener operations on them are not merged.
+///
+static void coalesce(oper_queue_t *q)
+{
+    int mask = q->cap - 1;
+
+    for (int i = 0; i < q->size; ++i) {
+        int pos = (q->head + i) & mask;
+        event_oper_t &op = q->ops[pos];
+
+        if (op.oper != EVENT_OPER_EMIT) {
+            coalesce_fence(op);
+            continue;
+        }
+        if (op.evt < 0 || op.evt >= (int)s_policies.size()
+                || s_policies[op.evt] == EVENT_COALESCE_NONE) {
+            continue;
         }
+
+        int prev = index_find(&s_merges, op.evt, op.oid);
+
+        if (prev < 0) {
+            index_insert(&s_merges, op.evt, op.oid, pos);
+            continue;
+        }
+
+        event_oper_t &kept = q->ops[prev];
+
+        switch (s_policies[op.evt]) {
+            case EVENT_COALESCE_ONCE:
+                op.oper = EVENT_OPER_COALESCED;
+                continue;
+            case EVENT_COALESCE_SUM:
+                op.arg_a += kept.arg_a;
+                op.arg_b += kept.arg_b;
+                break;
+            default: // EVENT_COALESCE_LAST
+                break;
+        }
+        kept.oper = EVENT_OPER_COALESCED; // delivered at the last position
+        index_insert(&s_merges, op.evt, op.oid, pos);
     }
+    index_clear(&s_merges);
 }
 
-static void emit(int evt, int arg_a, int arg_b, oid_t oid)
+static listener_t *listener_new(int evt, oid_t oid, bool any)
 {
-    LOG_TRACE("event", "<%lld> emit event %d:%d(%d).",
-            oid, evt, arg_a, arg_b);
+    listener_t *l = E_NEW listener_t;
+    int li = -1;
+
+    l->evt = evt;
+    l->oid = oid;
+    l->any = any;
+    l->dead = 0;
+    if (s_free_listeners.empty()) {
+        li = s_listeners.size();
+        s_listeners.push_back(l);
+    } else {
+        li = s_free_listeners.back();
+        s_free_listeners.pop_back();
+        s_listeners[li] = l;
+    }
+    if (any) {
+        index_insert(&s_any_index, evt, OID_NIL, li);
+        return l;
+    }
+    index_insert(&s_index, evt, oid, li);
+
+    // index listeners of the owner
+    int oi = index_find(&s_owners, 0, oid);
+
+    if (oi < 0) {
+        if (s_free_owners.empty()) {
+            oi = s_owner_lists.size();
+            s_owner_lists.push_back(E_NEW std::vector<int>);
+        } else {
+            oi = s_free_owners.back();
+            s_free_owners.pop_back();
+            s_owner_lists[oi] = E_NEW std::vector<int>;
+        }
+        index_insert(&s_owners, 0, oid, oi);
+    }
+    s_owner_lists[oi]->push_back(li);
+    return l;
+}
 
-    // get event listeners
-    listener_map::iterator itr = s_listeners.find(evt);
+static void listener_del(int li)
+{
+    listener_t *l = s_listeners[li];
 
-    if (itr == s_listeners.end()) {
+    if (l->any) {
+        index_erase(&s_any_index, l->evt, OID_NIL);
+        E_DELETE(l);
+        s_listeners[li] = NULL;
+        s_free_listeners.push_back(li);
         return;
     }
 
-    // get listener
-    listener_list *ll = itr->second;
-    listener_list::iterator itr_l = ll->find(oid);
+    int oi = index_find(&s_owners, 0, l->oid);
+
+    assert(oi >= 0);
+
+    std::vector<int> *ol = s_owner_lists[oi];
+
+    for (size_t i = 0; i < ol->size(); ++i) {
+        if ((*ol)[i] == li) {
+            (*ol)[i] = ol->back();
+            ol->pop_back();
+            break;
+        }
+    }
+    if (ol->empty()) {
+        E_DELETE(ol);
+        s_owner_lists[oi] = NULL;
+        s_free_owners.push_back(oi);
+        index_erase(&s_owners, 0, l->oid);
+    }
+    index_erase(&s_index, l->evt, l->oid);
+    E_DELETE(l);
+    s_listeners[li] = NULL;
+    s_free_listeners.push_back(li);
+}
+
+///
+/// Mark matched callbacks as tombstones, compacted by event_proc.
+///
+static void listener_kill(int li, oid_t lid)
+{
+    listener_t *l = s_listeners[li];
+    int dead = l->dead;
+
+    for (size_t i = 0; i < l->cbs.size(); ++i) {
+        callback_t &cb = l->cbs[i];
+
+        if (cb.func != NULL && (lid == OID_NIL || lid == cb.lid)) {
+            cb.func = NULL;
+            ++l->dead;
+        }
+    }
+    if (dead == 0 && l->dead > 0) {
+        s_dirty.push_back(li);
+    }
+}
+
+///
+/// Remove tombstones between frames.
+///
+static void compact(void)
+{
+    for (size_t i = 0; i < s_dirty.size(); ++i) {
+        int li = s_dirty[i];
+        listener_t *l = s_listeners[li];
+        size_t n = 0;
+
+        for (size_t j = 0; j < l->cbs.size(); ++j) {
+            if (l->cbs[j].func != NULL) {
+                l->cbs[n++] = l->cbs[j];
+            }
+        }
+        l->cbs.resize(n);
+        l->dead = 0;
+        if (n == 0) {
+            listener_del(li);
+        }
+    }
+    s_dirty.clear();
+}
+
+static void regist(int evt, const callback_t *cb, bool any)
+{
+    assert(cb);
+    int li = any ? index_find(&s_any_index, evt, OID_NIL)
+        : index_find(&s_index, evt, cb->oid);
+    listener_t *l = (li >= 0) ? s_listeners[li]
+        : listener_new(evt, any ? OID_NIL : cb->oid, any);
+
+    for (size_t i = 0; i < l->cbs.size(); ++i) {
+        if (l->cbs[i].func != NULL && l->cbs[i].lid == cb->lid) {
+            LOG_WARN("event", "<%lld><%lld> regist event %d (%d) ALREADY.",
+                    cb->oid, cb->lid, evt, cb->larg);
+            return;
+        }
+    }
+    l->cbs.push_back(*cb);
+    LOG_TRACE("event", "<%lld><%lld> regist event %d (%d).",
+            cb->oid, cb->lid, evt, cb->larg);
+}
+
+static void unregist_any(int evt, oid_t lid)
+{
+    LOG_TRACE("event", "<*> <%lld> unregist event %d.", lid, evt);
+    if (evt > 0) {
+        int li = index_find(&s_any_index, evt, OID_NIL);
 
-    if (itr_l == ll->end()) {
+        if (li >= 0) {
+            listener_kill(li, lid);
+        }
         return;
     }
+    for (int i = 0; i < s_any_index.cap; ++i) {
+        const slot_t &s = s_any_index.slots[i];
+
+        if (s.idx >= 0) {
+            listener_kill(s.idx, lid);
+        }
+    }
+}
+
+static inline time64_t time_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (time64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+///
+/// Pseudo random sequence for sampling, avoiding aliasing with periodic
+/// emissions.
+///
+static inline unsigned int sample_next(void)
+{
+    unsigned int x = s_sample_seed;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    s_sample_seed = x;
+    return x;
+}
+
+///
+/// Record sampled callback.
+/// @param cost Callback time(us).
+/// @param resid Time from emitted to dispatched(us).
+///
+static void profile(int evt, int ltype, time64_t cost, time64_t resid)
+{
+    int pi = index_find(&s_prof_index, evt, ltype);
+
+    if (pi < 0) {
+        prof_t p;
+
+        memset(&p, 0, sizeof(p));
+        p.evt = evt;
+        p.ltype = ltype;
+        pi = s_profs.size();
+        s_profs.push_back(p);
+        index_insert(&s_prof_index, evt, ltype, pi);
+    }
+
+    prof_t &p = s_profs[pi];
 
-    callback_list *cl = itr_l->second;
-    callback_list::iterator itr_c = cl->begin();
+    ++p.calls;
+    p.cost += cost;
+    p.cost_max = std::max(p.cost_max, (uint64_t)cost);
+    p.resid += resid;
+    p.resid_max = std::max(p.resid_max, (uint64_t)resid);
+}
 
-    for (; itr_c != cl->end(); ++itr_c) {
-        callback_t *cb = itr_c->second;
+static bool prof_cmp(const prof_t &l, const prof_t &r)
+{
+    return l.cost > r.cost;
+}
+
+///
+/// Call listeners.
+/// @param time Emitted time(us), profiled if not 0.
+///
+static void dispatch(std::vector<callback_t> &cbs, int evt, int arg_a,
+        int arg_b, oid_t oid, time64_t time)
+{
+    for (size_t i = 0; i < cbs.size(); ++i) {
+        callback_t *cb = &cbs[i];
 
+        if (cb->func == NULL) {
+            continue;
+        }
         cb->tid = oid;
+        cb->evt = evt;
         cb->targ_a = arg_a;
         cb->targ_b = arg_b;
+        if (time == 0) {
+            cb->func(cb);
+            continue;
+        }
+
+        time64_t start = time_us();
+        int ltype = cb->ltype; // cb may be reused by callback
+
         cb->func(cb);
+        profile(evt, ltype, time_us() - start, start - time);
+    }
+}
+
+static void unregist(int evt, oid_t oid, oid_t lid)
+{
+    LOG_TRACE("event", "<%lld> <%lld> unregist event %d.",
+            oid, lid, evt);
+    if (evt > 0) {
+        int li = index_find(&s_index, evt, oid);
+
+        if (li < 0) {
+            LOG_WARN("event", "<%lld> has NO event %d.",
+                    oid, evt);
+            return;
+        }
+        listener_kill(li, lid);
+    } else {
+        int oi = index_find(&s_owners, 0, oid);
+
+        if (oi < 0) {
+            return;
+        }
+
+        const std::vector<int> &ol = *s_owner_lists[oi];
+
+        for (size_t i = 0; i < ol.size(); ++i) {
+            listener_kill(ol[i], lid);
+        }
+    }
+}
+
+static void emit(int evt, int arg_a, int arg_b, oid_t oid, time64_t time)
+{
+    LOG_TRACE("event", "<%lld> emit event %d:%d(%d).",
+            oid, evt, arg_a, arg_b);
+
+    // callbacks are not added or removed while emitting
+    int li = index_find(&s_index, evt, oid);
+
+    if (li >= 0) {
+        dispatch(s_listeners[li]->cbs, evt, arg_a, arg_b, oid, time);
+    }
+    if (s_any_index.size == 0) {
+        return;
+    }
+    li = index_find(&s_any_index, evt, OID_NIL);
+    if (li >= 0) {
+        dispatch(s_listeners[li]->cbs, evt, arg_a, arg_b, oid, time);
     }
 }
 
 int event_init(void)
 {
     MODULE_IMPORT_SWITCH;
+    index_init(&s_index, INDEX_SIZE_MIN);
+    index_init(&s_owners, INDEX_SIZE_MIN);
+    index_init(&s_any_index, INDEX_SIZE_MIN);
+    index_init(&s_merges, INDEX_SIZE_MIN);
+    index_init(&s_prof_index, INDEX_SIZE_MIN);
+    queue_init(s_queues, QUEUE_SIZE_MIN);
+    queue_init(s_queues + 1, QUEUE_SIZE_MIN);
+    s_cur = 0;
+    s_owner = pthread_self();
+    pthread_key_create(&s_ingress_key, ingress_exit);
     return 0;
 }
 
 int event_fini(void)
 {
     MODULE_IMPORT_SWITCH;
+    for (size_t i = 0; i < s_listeners.size(); ++i) {
+        E_DELETE(s_listeners[i]);
+    }
+    for (size_t i = 0; i < s_owner_lists.size(); ++i) {
+        E_DELETE(s_owner_lists[i]);
+    }
+    s_listeners.clear();
+    s_free_listeners.clear();
+    s_owner_lists.clear();
+    s_free_owners.clear();
+    s_dirty.clear();
+    index_fini(&s_index);
+    index_fini(&s_owners);
+    index_fini(&s_any_index);
+    index_fini(&s_merges);
+    index_fini(&s_prof_index);
+    s_profs.clear();
+    s_policies.clear();
+    s_policy_num = 0;
+    pthread_key_delete(s_ingress_key);
+    while (s_ingresses != NULL) {
+        ingress_t *in = s_ingresses;
+
+        s_ingresses = in->next;
+        ingress_fini(in);
+    }
+    for (int i = 0; i < 2; ++i) {
+        oper_queue_t *q = s_queues + i;
+
+        for (; q->size > 0; --q->size) { // not handled
+            event_oper_t &op = q->ops[q->head];
+
+            if (op.cb != NULL) {
+                E_FREE(op.cb);
+            }
+            q->head = (q->head + 1) & (q->cap - 1);
+        }
+        queue_fini(q);
+    }
     return 0;
 }
 
 int event_proc(void)
 {
-    std::list<event_oper_t *> ops;
+    ingress_drain();
 
-    s_ops.swap(ops);
+    // operations pushed while processing are handled in the next frame
+    oper_queue_t *q = s_queues + s_cur;
 
-    std::list<event_oper_t *>::const_iterator itr = ops.begin();
-    for (; itr != ops.end(); ++itr) {
-        event_oper_t *op = *itr;
+    s_cur ^= 1;
+    if (s_policy_num > 0) {
+        coalesce(q);
+    }
+    for (; q->size > 0; --q->size) {
+        event_oper_t &op = q->ops[q->head];
 
-        switch (op->oper) {
+        q->head = (q->head + 1) & (q->cap - 1);
+        switch (op.oper) {
             case EVENT_OPER_REGIST:
-                regist(op->evt, op->cb);
+                regist(op.evt, op.cb, false);
+                E_FREE(op.cb);
+                break;
+            case EVENT_OPER_REGIST_ANY:
+                for (int evt = op.evt; evt <= op.arg_a; ++evt) {
+                    regist(evt, op.cb, true);
+                }
+                E_FREE(op.cb);
+                break;
+            case EVENT_OPER_UNREGIST_ANY:
+                unregist_any(op.evt, op.lid);
                 break;
             case EVENT_OPER_UNREGIST:
-                unregist(op->evt, op->oid, op->lid);
+                unregist(op.evt, op.oid, op.lid);
                 break;
             case EVENT_OPER_EMIT:
-                emit(op->evt, op->arg_a, op->arg_b, op->oid);
+                emit(op.evt, op.arg_a, op.arg_b, op.oid, op.time);
+                break;
+            case EVENT_OPER_COALESCED:
                 break;
             default:
                 assert(0);
                 break;
         }
-        E_DELETE(op);
     }
+    q->head = 0;
+    compact();
     return 0;
 }
 
-void event_regist(int evt, callback_t *cb)
+static void push(const event_oper_t &op)
 {
-    event_oper_t *op = E_NEW event_oper_t(evt, cb);
+    if (pthread_equal(pthread_self(), s_owner)) {
+        queue_push(op);
+    } else {
+        ingress_push(op);
+    }
+}
 
-    s_ops.push_back(op);
+void event_regist(int evt, callback_t *cb)
+{
+    push(event_oper_t(evt, cb));
 }
 
 void event_unregist(oid_t oid, oid_t lid, int evt)
 {
-    event_oper_t *op = E_NEW event_oper_t(evt, oid, lid);
-
-    s_ops.push_back(op);
+    push(event_oper_t(evt, oid, lid));
 }
 
 void event_emit(int evt, int arg_a, int arg_b, oid_t oid)
 {
-    event_oper_t *op = E_NEW event_oper_t(evt, arg_a, arg_b, oid);
+    event_oper_t op(evt, arg_a, arg_b, oid);
 
-    s_ops.push_back(op);
+    if (s_sample == 1 || (s_sample > 1 && sample_next() % s_sample == 0)) {
+        op.time = time_us();
+    }
+    push(op);
+}
+
+void event_regist_any(int evt, callback_t *cb)
+{
+    event_regist_range(evt, evt, cb);
+}
+
+void event_regist_range(int evt_begin, int evt_end, callback_t *cb)
+{
+    assert(evt_begin > 0 && evt_begin <= evt_end
+            && evt_end - evt_begin < EVENT_RANGE_MAX);
+
+    event_oper_t op(evt_begin, cb);
+
+    op.oper = EVENT_OPER_REGIST_ANY;
+    op.arg_a = evt_end;
+    push(op);
 }
-} // namespace elf
 
+void event_unregist_any(oid_t lid, int evt)
+{
+    event_oper_t op(evt, OID_NIL, lid);
+
+    op.oper = EVENT_OPER_UNREGIST_ANY;
+    push(op);
+}
+
+void event_coalesce(int evt, int policy)
+{
+    assert(evt > 0 && policy >= EVENT_COALESCE_NONE
+            && policy <= EVENT_COALESCE_ONCE);
+    if (evt >= (int)s_policies.size()) {
+        s_policies.resize(evt + 1, EVENT_COALESCE_NONE);
+    }
+    if (s_policies[evt] == EVENT_COALESCE_NONE) {
+        s_policy_num += (policy != EVENT_COALESCE_NONE);
+    } else {
+        s_policy_num -= (policy == EVENT_COALESCE_NONE);
+    }
+    s_policies[evt] = policy;
+}
+
+void event_profile(int sample)
+{
+    assert(sample >= 0);
+    s_sample = sample;
+}
+
+void event_stat(void)
+{
+    std::vector<prof_t> profs(s_profs);
+
+    std::sort(profs.begin(), profs.end(), prof_cmp);
+    LOG_INFO("event", "LISTENER: %d OWNER: %d ANY: %d SAMPLE: 1/%d.",
+            (int)(s_listeners.size() - s_free_listeners.size()),
+            s_owners.size, s_any_index.size, s_sample);
+    for (size_t i = 0; i < profs.size(); ++i) {
+        const prof_t &p = profs[i];
+
+        LOG_INFO("event",
+                "EVT: %d TYPE: %d N: %llu COST(us) SUM: %llu AVG: %llu"
+                " MAX: %llu QUEUE(us) AVG: %llu MAX: %llu.",
+                p.evt, p.ltype, p.calls, p.cost, p.cost / p.calls,
+                p.cost_max, p.resid / p.calls, p.resid_max);
+    }
+}
+} // namespace elf
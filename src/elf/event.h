@@ -8,6 +8,10 @@
  * @author Fox (yulefox at gmail.com)
  * @date 2011-01-10
  * Event module.
+ * event_regist/event_unregist/event_emit may be called in any thread,
+ * operations of other threads are handled by the next event_proc in order
+ * of each thread. Listeners are always called by event_proc, in the thread
+ * calling event_init.
  */
 
 
@@ -22,12 +26,35 @@
 #include <elf/oid.h>
 
 namespace elf {
+enum event_coalesce {
+    EVENT_COALESCE_NONE = 0, // deliver every emission
+    EVENT_COALESCE_LAST, // deliver the last one
+    EVENT_COALESCE_SUM, // deliver the last one with summed arg_a/arg_b
+    EVENT_COALESCE_ONCE, // deliver the first one
+};
+
 int event_init(void);
 int event_fini(void);
 int event_proc(void);
 
+///
+/// Log sizes, and profile of listeners by (evt, ltype) sorted by callback
+/// time: sampled calls, callback time and queue time(from event_emit to
+/// dispatched).
+///
+void event_stat(void);
+
+///
+/// Enable/Disable profiling listeners.
+/// @param sample Profile 1 of sample emissions, 1 for all, 0 to disable.
+///
+void event_profile(int sample);
+
 ///
 /// Regist new event listener.
+/// The listener is copied, and `cb`(allocated by E_ALLOC) is freed once the
+/// regist is processed by event_proc, do not keep it. Callbacks get the
+/// copy as args, unregist by oid/lid.
 /// @param evt Event type.
 /// @param cb Callback handle.
 /// @param lid Listener id.
@@ -43,6 +70,39 @@ void event_regist(int evt, callback_t *cb);
 ///
 void event_unregist(oid_t oid,  oid_t lid = OID_NIL, int evt = 0);
 
+///
+/// Regist listener of given event emitted by any owner.
+/// @param evt Event type.
+/// @param cb Callback handle, cb->oid is ignored when emitting.
+///
+void event_regist_any(int evt, callback_t *cb);
+
+///
+/// Regist listener of events in [evt_begin, evt_end] emitted by any owner,
+/// cb->evt is set to the emitted event.
+/// @param evt_begin The first event type.
+/// @param evt_end The last event type.
+/// @param cb Callback handle.
+///
+void event_regist_range(int evt_begin, int evt_end, callback_t *cb);
+
+///
+/// Unregist listener of any owner.
+/// @param lid Listener id, unregist all if OID_NIL.
+/// @param evt Event type, unregist all about given listener if 0.
+///
+void event_unregist_any(oid_t lid, int evt = 0);
+
+///
+/// Set coalescing policy of event, emissions with the same (evt, oid)
+/// handled by one event_proc are delivered once, unless listeners of them
+/// are registered/unregistered between. Called in the thread calling
+/// event_init.
+/// @param evt Event type.
+/// @param policy event_coalesce.
+///
+void event_coalesce(int evt, int policy);
+
 ///
 /// Emit event.
 /// @param evt Event type.
@@ -1,5 +1,6 @@
 #include <elf/oid.h>
 #include <elf/memory.h>
+#include <elf/object.h>
 #include <elf/time.h>
 #include <elf/rand.h>
 #include <elf/matchmaking.h>
@@ -22,6 +23,8 @@ namespace elf {
     }
 
     struct MatchEntity {
+        OBJECT_POOL(MatchEntity)
+
         oid_t id;
         int elo;
         int status;
@@ -12,6 +12,7 @@ namespace elf {
 struct message_handler_t {
     pb_new init;
     msg_proc proc;
+    stat_msg_t *stat;
 };
 
 typedef std::map<std::string, message_handler_t *> reg_map;
@@ -33,6 +34,7 @@ void message_regist(const std::string &name, pb_new init, msg_proc proc)
 
     hdl->init = init;
     hdl->proc = proc;
+    hdl->stat = net_stat_slot(name);
     s_regs[name] = hdl;
 }
 
@@ -47,7 +49,7 @@ void message_handle(recv_message_t *msg)
 
         msg->pb = hdl->init();
         if (net_decode(msg)) {
-            net_stat_message(*msg);
+            net_stat_message(*msg, hdl->stat);
             hdl->proc(*msg);
         }
     } else if ((msg->ctx != NULL) && !net_internal(*(msg->ctx))) {
@@ -7,10 +7,12 @@
 #include <elf/net/net.h>
 #include <elf/net/message.h>
 #include <elf/pc.h>
+#include <elf/rand.h>
 #include <elf/thread.h>
 #include <elf/time.h>
 #include <arpa/inet.h>
 #include <fcntl.h>
+#include <linux/errqueue.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
 #include <sys/types.h>
@@ -20,11 +22,28 @@
 #include <map>
 #include <queue>
 #include <string>
+#include <vector>
+
+#ifndef SO_ZEROCOPY
+#   define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#   define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#   define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#   define SO_EE_CODE_ZEROCOPY_COPIED 1
+#endif
 
 namespace elf {
 static const int LINGER_ONOFF = 0;
 static const int LINGER_TIME = 5;
 static const int CONTEXT_CLOSE_TIME = 90;
+static const time64_t CONNECT_TIMEOUT = 3000; // (ms)
+static const time64_t CONNECT_RETRY_MIN = 500; // (ms)
+static const time64_t CONNECT_RETRY_MAX = 30000; // (ms)
 static const int SIZE_INT = sizeof(int(0));
 static const int SIZE_INTX2 = sizeof(int(0)) * 2;
 static const int CHUNK_SIZE_S = 256;
@@ -35,75 +54,156 @@ static const int MESSAGE_MAX_VALID_SIZE = CHUNK_MAX_NUM * CHUNK_SIZE_L;
 static const int MESSAGE_MAX_PENDING_SIZE = MESSAGE_MAX_VALID_SIZE * 2;
 static const int BACKLOG = 128;
 static const int ENCRYPT_FLAG = 0x40000000;
+static const int FRAGMENT_FLAG = 0x20000000;
+static const int FRAGMENT_LAST = 0x10000000;
+static const int FRAGMENT_SIZE = CHUNK_SIZE_L * 4; // payload of fragment
+static const size_t FRAGMENT_MAX_STREAM = 64; // reassembling per peer
+static const int SEND_BUDGET = FRAGMENT_SIZE * 4; // bytes popped per write
 static const int WORKER_THREAD_SIZE = 4; // (2^n)
 static const int WORKER_THREAD_SIZE_MASK = WORKER_THREAD_SIZE - 1;
+#define CACHE_LINE_SIZE 64
 
 struct blob_t;
 struct chunk_t;
 struct context_t;
+struct frame_t;
 struct peer_t;
 struct recv_message_t;
 struct stat_msg_t;
 
 typedef std::list<chunk_t *> chunk_queue;
-typedef std::map<std::string, stat_msg_t *> msg_map;
+typedef std::deque<blob_t *> blob_queue;
+typedef std::map<int, std::string> fragment_map;
+typedef std::deque<std::pair<uint32_t, frame_t *> > zerocopy_queue;
+typedef std::map<std::string, stat_msg_t *> stat_msg_map;
+typedef std::vector<context_t *> member_array;
+typedef std::map<oid_t, member_array> group_map;
 typedef std::queue<context_t *> context_queue;
 typedef xqueue<context_t *> context_xqueue;
 typedef xqueue<blob_t*> write_context_xqueue;
 typedef std::deque<recv_message_t *> recv_message_queue;
 typedef xqueue<recv_message_t *> recv_message_xqueue;
 
+enum stat_counter {
+    STAT_SEND_MSG_NUM, // number of send msg
+    STAT_SEND_MSG_SIZE, // size of send msg
+    STAT_RECV_MSG_NUM, // number of recv msg
+    STAT_RECV_MSG_SIZE, // size of recv msg
+    STAT_CONTEXT_CREATED,
+    STAT_CONTEXT_RELEASED,
+    STAT_CHUNK_CREATED,
+    STAT_CHUNK_RELEASED,
+    STAT_ZEROCOPY_SENT, // number of zerocopy send
+    STAT_ZEROCOPY_COPIED, // number of zerocopy send copied by kernel
+    STAT_SIZE,
+};
+
+// counters of one thread, merged on read, never released
+struct stat_block_t {
+    uint64_t counters[STAT_SIZE];
+    stat_block_t *next;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+// statistics of recv msg, updated in main thread
 struct stat_msg_t {
-    int msg_num; // number of recv given msg
-    int msg_size; // size of recv given msg
+    std::string name;
+    int type; // NET_STAT_REQ, NET_STAT_RES
+    uint64_t msg_num; // number of recv given msg
+    uint64_t msg_size; // size of recv given msg
+    uint64_t last_num; // msg_num of last output
+    uint64_t last_size; // msg_size of last output
+};
 
-    stat_msg_t() :
-        msg_num(0), 
-        msg_size(0)
-    {
+static __thread stat_block_t *s_stat_block;
+static stat_block_t *s_stat_blocks; // all blocks
+static uint64_t s_stat_last[STAT_SIZE]; // counters of last output
+static time64_t s_stat_time; // time of last output
+static stat_msg_map s_stat_msgs; // slots of recv msgs
+
+static stat_block_t *stat_block_init(void)
+{
+    void *buf = NULL;
+
+    if (posix_memalign(&buf, CACHE_LINE_SIZE, sizeof(stat_block_t)) != 0) {
+        abort();
     }
-};
 
-struct stat_t {
-    int send_msg_num; // number of send msg
-    int send_msg_size; // size of send msg
-    int recv_msg_num; // number of recv msg
-    int recv_msg_size; // size of recv msg
-    msg_map req_msgs; // request message map
-    msg_map res_msgs; // response message map
-    size_t context_size_created;
-    size_t context_size_released;
-    size_t chunk_size_created;
-    size_t chunk_size_released;
-
-    stat_t() :
-        send_msg_num(0), 
-        send_msg_size(0),
-        recv_msg_num(0), 
-        recv_msg_size(0),
-        context_size_created(0),
-        context_size_released(0),
-        chunk_size_created(0),
-        chunk_size_released(0)
-    {
+    stat_block_t *blk = (stat_block_t *)buf;
+
+    memset(blk, 0, sizeof(*blk));
+    do {
+        blk->next = s_stat_blocks;
+    } while (!__sync_bool_compare_and_swap(&s_stat_blocks, blk->next, blk));
+    s_stat_block = blk;
+    return blk;
+}
+
+///
+/// Add to counter of current thread, no lock or atomic RMW.
+///
+static inline void stat_add(int counter, uint64_t n)
+{
+    stat_block_t *blk = s_stat_block;
+
+    if (blk == NULL) {
+        blk = stat_block_init();
     }
-};
 
-static stat_t s_stat;
+    uint64_t *c = blk->counters + counter;
+
+    __atomic_store_n(c, *c + n, __ATOMIC_RELAXED);
+}
+
+///
+/// Merge counters of all threads.
+///
+static void stat_merge(uint64_t *counters)
+{
+    stat_block_t *blk = __atomic_load_n(&s_stat_blocks, __ATOMIC_ACQUIRE);
+
+    memset(counters, 0, sizeof(uint64_t) * STAT_SIZE);
+    for (; blk != NULL; blk = blk->next) {
+        for (int i = 0; i < STAT_SIZE; ++i) {
+            counters[i] += __atomic_load_n(blk->counters + i, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+// operation of blob pushed to writer thread
+enum blob_oper {
+    BLOB_SEND,
+    BLOB_GROUP_JOIN,
+    BLOB_GROUP_LEAVE,
+    BLOB_GROUP_SEND,
+    BLOB_GROUP_PURGE, // context closed, leave all groups
+};
 
 struct blob_t {
     chunk_queue chunks;
     int msg_size; // current recv msg size(for splicing)
     int total_size; // total send/recv msg size
     int pending_size; // pending send/recv msg size
+    int prio; // net_prio of send msg
+    bool encrypt; // encipher in writer thread
+    int oper; // blob_oper
+    oid_t group;
     context_t *ctx;
 };
 
+// encoded message shared by chunks, sent by MSG_ZEROCOPY
+struct frame_t {
+    int ref;
+    int size;
+    char data[0];
+};
+
 struct chunk_t {
     int real_size;
     int data_size;
     int wr_offset;
     int rd_offset;
+    frame_t *frame; // shared frame referenced, or NULL
+    int offset; // offset in shared frame
     char data[0];
 };
 
@@ -129,16 +229,31 @@ struct context_t {
     int close_time;
     int last_time;
     int error_times;
+    int worker; // reader/writer thread index
     bool internal;
+    bool connecting; // outgoing connection not established yet
+    int connect_times; // failed connecting times in a row
+    time64_t connect_time; // start time of current connecting (ms)
+    time64_t retry_time; // time of next connecting (ms)
+    struct sockaddr_storage addr; // peer address
+    socklen_t addr_len;
+    bool zerocopy; // SO_ZEROCOPY enabled
+    uint32_t zerocopy_seq; // id of next zerocopy send
+    zerocopy_queue zerocopy_pending; // frames waiting for completion
+    bool fragment; // split large messages into fragments
+    int fragment_seq; // stream id of next fragmented message
+    blob_queue send_units[NET_PRIO_SIZE]; // msgs/fragments to be sent
+    fragment_map fragments; // fragments being reassembled
+    int fragment_size; // bytes of fragments being reassembled
 
     context_t()
     {
-        ++s_stat.context_size_created;
+        stat_add(STAT_CONTEXT_CREATED, 1);
     }
 
     ~context_t()
     {
-        ++s_stat.context_size_released;
+        stat_add(STAT_CONTEXT_RELEASED, 1);
     }
 };
 
@@ -151,16 +266,21 @@ static thread_t s_reader_tid[WORKER_THREAD_SIZE]; // reader thread
 static thread_t s_cid; // context thread
 static context_xqueue s_pending_read[WORKER_THREAD_SIZE];
 static write_context_xqueue s_pending_write[WORKER_THREAD_SIZE];
+static group_map s_groups[WORKER_THREAD_SIZE]; // members owned by writer
 static spin_t s_context_lock;
 static spin_t s_pre_context_lock;
+static spin_t s_connect_lock;
 static int s_epoll;
 static int s_sock;
 static int s_sock6;
 static recv_message_xqueue s_recv_msgs;
 static context_map s_contexts;
 static context_set s_pre_contexts;
+static context_set s_connecting;
 static context_queue s_free_contexts;
 static std::set<std::string> s_raw_msgs;
+static std::map<std::string, int> s_msg_prios;
+static int s_zerocopy_size; // 0: zerocopy disabled
 
 ///
 /// Running.
@@ -175,16 +295,37 @@ static context_t *context_init6(int idx, oid_t peer, int fd,
 static context_t *context_find(oid_t peer);
 static void context_close(oid_t peer);
 static void context_fini(context_t *ctx);
+static void context_notify(context_t *ctx, const char *name);
+static int connect_start(context_t *ctx);
+static void connect_fail(context_t *ctx);
+static void connect_update(void);
 static void on_accept6(const epoll_event &evt);
+static void on_connect(const epoll_event &evt);
 static void on_read(const epoll_event &evt);
 static void on_read(context_t *ctx);
 static bool on_write(context_t *ctx);
 static void on_error(const epoll_event &evt);
+static bool on_errqueue(const epoll_event &evt);
+static void zerocopy_reap(context_t *ctx);
 static void append_send(context_t *ctx, blob_t *msg);
+static void group_oper(group_map &groups, blob_t *msg,
+        context_map &pending_ctxs);
 static void blob_fini(blob_t *blob);
 static void *net_accepter(void *args);
 static void set_nonblock(int sock);
+static void set_zerocopy(context_t *ctx);
+
+
+static int msg_priority(const std::string &name)
+{
+    if (s_msg_prios.empty()) {
+        return NET_PRIO_NORMAL;
+    }
 
+    std::map<std::string, int>::const_iterator itr = s_msg_prios.find(name);
+
+    return (itr == s_msg_prios.end()) ? NET_PRIO_NORMAL : itr->second;
+}
 
 static bool is_raw_msg(const std::string &name)
 {
@@ -215,8 +356,9 @@ static void *context_thread(void *args)
         for (itr = pre_peers.begin(); itr != pre_peers.end(); ++itr) {
             context_close(*itr);
         }
+        connect_update();
 
-        time_t ct = time_s();
+        time_t ct = time_s(); // not the frame cache of main thread
 
         while (!s_free_contexts.empty()) {
             context_t *ctx = s_free_contexts.front();
@@ -257,6 +399,7 @@ static void *net_accepter(void *args)
 
         context_t *ctx = context_init(0, OID_NIL, fd, addr);
         LOG_DEBUG("net", "%s", "accept new connection...");
+        context_notify(ctx, "Init.Req");
 
         if (0 != epoll_ctl(s_epoll, EPOLL_CTL_ADD, fd, &(ctx->evt))) {
             LOG_ERROR("net", "%s epoll_ctl FAILED: %s.", ctx->peer.info, strerror(errno));
@@ -286,6 +429,7 @@ static void *net_writer(void *args)
     std::map<oid_t, context_t*> pending_ctxs;
     std::map<oid_t, context_t*>::iterator itr_ctx;
     write_context_xqueue *q = (write_context_xqueue *)(args);
+    group_map &groups = s_groups[q - s_pending_write];
     while (true) {
         std::deque<blob_t*> reqs;
         std::deque<blob_t*>::iterator itr;
@@ -293,8 +437,11 @@ static void *net_writer(void *args)
         for (itr = reqs.begin();itr != reqs.end(); ++itr) {
             blob_t *msg = *itr;
             context_t *ctx = msg->ctx;
+            if (msg->oper != BLOB_SEND) {
+                group_oper(groups, msg, pending_ctxs);
+                continue;
+            }
             append_send(ctx, msg);
-            blob_fini(msg);
             pending_ctxs[ctx->peer.id] = ctx;
         }
         for (itr_ctx = pending_ctxs.begin();itr_ctx != pending_ctxs.end();) {
@@ -326,9 +473,11 @@ static int net_update(void)
     for (int i = 0; i < num; ++i) {
         if (evts[i].data.fd == s_sock6) {
             on_accept6(evts[i]);
+        } else if (static_cast<context_t *>(evts[i].data.ptr)->connecting) {
+            on_connect(evts[i]);
         } else if (evts[i].events & EPOLLIN) {
             on_read(evts[i]);
-        } else {
+        } else if (!on_errqueue(evts[i])) {
             on_error(evts[i]);
         }
     }
@@ -369,19 +518,99 @@ static void set_nonblock(int sock)
     }
 }
 
+static void set_zerocopy(context_t *ctx)
+{
+    int on = 1;
+
+    ctx->zerocopy = false;
+    if (s_zerocopy_size <= 0 || ctx->peer.sock < 0) {
+        return;
+    }
+    if (0 != setsockopt(ctx->peer.sock, SOL_SOCKET, SO_ZEROCOPY,
+                &on, sizeof(on))) {
+        LOG_WARN("net", "%s setsockopt(ZEROCOPY) FAILED: %s.",
+                ctx->peer.info,
+                strerror(errno));
+        return;
+    }
+    ctx->zerocopy = true;
+}
+
 static chunk_t *chunk_init(size_t size)
 {
     int real_size = size;
     chunk_t *c = (chunk_t *)E_ALLOC(sizeof(chunk_t) + real_size);
-    ++s_stat.chunk_size_created;
+    stat_add(STAT_CHUNK_CREATED, 1);
     c->wr_offset = 0;
     c->rd_offset = 0;
     c->data_size = size;
     c->real_size = real_size;
+    c->frame = NULL;
+    c->offset = 0;
     memset(c->data, 0, size);
     return c;
 }
 
+static frame_t *frame_init(const std::string &name, const std::string &body)
+{
+    int name_len = name.size();
+    int body_len = body.size();
+    int size = name_len + body_len + SIZE_INTX2;
+    frame_t *f = (frame_t *)E_ALLOC(sizeof(frame_t) + size);
+    char *dst = f->data;
+
+    f->ref = 1;
+    f->size = size;
+    memcpy(dst, &size, SIZE_INT);
+    dst += SIZE_INT;
+    memcpy(dst, &name_len, SIZE_INT);
+    dst += SIZE_INT;
+    memcpy(dst, name.data(), name_len);
+    dst += name_len;
+    memcpy(dst, body.data(), body_len);
+    return f;
+}
+
+static frame_t *frame_ref(frame_t *f)
+{
+    assert(f);
+    __sync_add_and_fetch(&(f->ref), 1);
+    return f;
+}
+
+static void frame_fini(frame_t *f)
+{
+    if (f != NULL && __sync_sub_and_fetch(&(f->ref), 1) == 0) {
+        E_FREE(f);
+    }
+}
+
+///
+/// View of shared frame.
+/// @param f Shared frame.
+/// @param offset Start of the view.
+/// @param size Size of the view.
+///
+static chunk_t *chunk_init(frame_t *f, int offset, int size)
+{
+    assert(f && offset >= 0 && offset + size <= f->size);
+
+    chunk_t *c = (chunk_t *)E_ALLOC(sizeof(chunk_t));
+    stat_add(STAT_CHUNK_CREATED, 1);
+    c->wr_offset = size;
+    c->rd_offset = 0;
+    c->data_size = size;
+    c->real_size = 0;
+    c->frame = frame_ref(f);
+    c->offset = offset;
+    return c;
+}
+
+static inline char *chunk_data(chunk_t *c)
+{
+    return (c->frame != NULL) ? c->frame->data + c->offset : c->data;
+}
+
 static chunk_t *chunk_init(const char *buf, size_t size)
 {
     chunk_t *c = chunk_init(size);
@@ -398,8 +627,9 @@ static void chunk_fini(chunk_t *c)
     if (c == NULL) {
         return;
     }
+    frame_fini(c->frame);
     E_FREE(c);
-    ++s_stat.chunk_size_released;
+    stat_add(STAT_CHUNK_RELEASED, 1);
 }
 
 static recv_message_t *recv_message_init(context_t *ctx)
@@ -503,39 +733,114 @@ static void message_get(chunk_queue &chunks, std::string &buf, int size)
     }
 }
 
-static bool message_splice(context_t *ctx)
-{
-    assert(ctx);
+static bool message_read(context_t *ctx, chunk_queue &chunks, int msg_size);
 
-    if (ctx->recv_data->pending_size < SIZE_INTX2) return false;
+///
+/// Append fragment to its stream, parse the message if it's the last one.
+/// Only internal or fragment enabled peers may send fragments, and bytes
+/// being reassembled count towards MESSAGE_MAX_PENDING_SIZE.
+/// @param flag Fragment flags.
+///
+static bool message_defrag(context_t *ctx, chunk_queue &chunks,
+        int msg_size, int flag)
+{
+    int len = msg_size - SIZE_INTX2 - SIZE_INT;
+    int stream = 0;
 
-    if (ctx->recv_data->pending_size > MESSAGE_MAX_PENDING_SIZE) {
-        LOG_WARN("net", "%s OVER PENDING message: %d.",
+    if (!ctx->internal && !ctx->fragment) {
+        LOG_WARN("net", "%s fragment NOT allowed.",
+                ctx->peer.info);
+        net_close(ctx->peer.id);
+        return false;
+    }
+    if (len < 0) {
+        LOG_TRACE("net", "%s INVALID fragment size: %d.",
                 ctx->peer.info,
-                ctx->recv_data->pending_size);
+                msg_size);
         net_close(ctx->peer.id);
         return false;
     }
+    message_get(chunks, &stream, SIZE_INT);
 
-    int &msg_size = ctx->recv_data->msg_size;
+    fragment_map::iterator itr = ctx->fragments.find(stream);
 
-    if (msg_size == 0) {
-        message_get(ctx->recv_data->chunks, &msg_size, SIZE_INT);
+    if (itr == ctx->fragments.end()) {
+        if (ctx->fragments.size() >= FRAGMENT_MAX_STREAM) {
+            LOG_WARN("net", "%s OVER fragment streams: %d.",
+                    ctx->peer.info,
+                    ctx->fragments.size());
+            net_close(ctx->peer.id);
+            return false;
+        }
+        itr = ctx->fragments.insert(std::make_pair(stream, std::string())).first;
     }
 
-    if (msg_size < 0 || msg_size > MESSAGE_MAX_VALID_SIZE) {
-        LOG_TRACE("net", "%s INVALID message size: %d.",
+    std::string &buf = itr->second;
+
+    if ((int)buf.size() + len > MESSAGE_MAX_VALID_SIZE) {
+        LOG_TRACE("net", "%s INVALID fragmented message size: %d.",
                 ctx->peer.info,
-                msg_size);
+                buf.size() + len);
+        net_close(ctx->peer.id);
+        return false;
+    }
+    if (ctx->fragment_size + len + ctx->recv_data->pending_size
+            > MESSAGE_MAX_PENDING_SIZE) {
+        LOG_WARN("net", "%s OVER fragment size: %d.",
+                ctx->peer.info,
+                ctx->fragment_size + len);
         net_close(ctx->peer.id);
         return false;
     }
+    message_get(chunks, buf, len); // appended
+    ctx->fragment_size += len;
+    if ((flag & FRAGMENT_LAST) == 0) {
+        return true;
+    }
 
-    if (ctx->recv_data->pending_size < msg_size) return false;
+    int size = 0;
+    int name_len = 0;
+
+    if (buf.size() >= (size_t)SIZE_INTX2) {
+        memcpy(&size, buf.data(), SIZE_INT);
+        memcpy(&name_len, buf.data() + SIZE_INT, SIZE_INT);
+    }
+    if (size != (int)buf.size() || (name_len & FRAGMENT_FLAG)) {
+        LOG_TRACE("net", "%s INVALID fragmented message: %d:%d.",
+                ctx->peer.info,
+                size, buf.size());
+        net_close(ctx->peer.id);
+        return false;
+    }
+
+    chunk_queue whole;
+
+    whole.push_back(chunk_init(buf.data(), buf.size()));
+    ctx->fragment_size -= (int)buf.size();
+    ctx->fragments.erase(itr);
+    message_get(whole, &size, SIZE_INT);
+
+    bool res = message_read(ctx, whole, size);
+    chunk_queue::iterator itr_c = whole.begin();
+
+    for (; itr_c != whole.end(); ++itr_c) {
+        chunk_fini(*itr_c);
+    }
+    return res;
+}
 
+///
+/// Parse message(size field has been read) from chunks.
+/// @param msg_size Message size.
+///
+static bool message_read(context_t *ctx, chunk_queue &chunks, int msg_size)
+{
     int name_len = 0;
     int flag = 0;
-    message_get(ctx->recv_data->chunks, &name_len, SIZE_INT);
+    message_get(chunks, &name_len, SIZE_INT);
+    if (name_len & FRAGMENT_FLAG) {
+        return message_defrag(ctx, chunks, msg_size, name_len);
+    }
     flag = ((name_len & ENCRYPT_FLAG) >> 30) & 0x1;
     if (flag == 1) {
         name_len ^= ENCRYPT_FLAG;
@@ -564,8 +869,8 @@ static bool message_splice(context_t *ctx)
         char *body = (char *)E_ALLOC(body_len + 1);
         memset(name, 0, name_len + 1);
         memset(body, 0, body_len + 1);
-        message_get(ctx->recv_data->chunks, name, name_len);
-        message_get(ctx->recv_data->chunks, body, body_len);
+        message_get(chunks, name, name_len);
+        message_get(chunks, body, body_len);
         cipher_t *decipher = ctx->decipher;
         if (decipher == NULL) {
             LOG_ERROR("net", "%s", "get encrypted message, but can't get decipher");
@@ -578,12 +883,48 @@ static bool message_splice(context_t *ctx)
         E_FREE(name);
         E_FREE(body);
     } else {
-        message_get(ctx->recv_data->chunks, msg->name, name_len);
-        message_get(ctx->recv_data->chunks, msg->body, body_len);
+        message_get(chunks, msg->name, name_len);
+        message_get(chunks, msg->body, body_len);
     }
 
     msg->peer = ctx->peer.id;
     s_recv_msgs.push(msg);
+    return true;
+}
+
+static bool message_splice(context_t *ctx)
+{
+    assert(ctx);
+
+    if (ctx->recv_data->pending_size < SIZE_INTX2) return false;
+
+    if (ctx->recv_data->pending_size > MESSAGE_MAX_PENDING_SIZE) {
+        LOG_WARN("net", "%s OVER PENDING message: %d.",
+                ctx->peer.info,
+                ctx->recv_data->pending_size);
+        net_close(ctx->peer.id);
+        return false;
+    }
+
+    int &msg_size = ctx->recv_data->msg_size;
+
+    if (msg_size == 0) {
+        message_get(ctx->recv_data->chunks, &msg_size, SIZE_INT);
+    }
+
+    if (msg_size < 0 || msg_size > MESSAGE_MAX_VALID_SIZE) {
+        LOG_TRACE("net", "%s INVALID message size: %d.",
+                ctx->peer.info,
+                msg_size);
+        net_close(ctx->peer.id);
+        return false;
+    }
+
+    if (ctx->recv_data->pending_size < msg_size) return false;
+
+    if (!message_read(ctx, ctx->recv_data->chunks, msg_size)) {
+        return false;
+    }
 
     ctx->recv_data->pending_size -= msg_size;
     ctx->recv_data->total_size += msg_size;
@@ -598,6 +939,11 @@ static void blob_init(blob_t *blob)
     blob->msg_size = 0;
     blob->total_size = 0;
     blob->pending_size = 0;
+    blob->prio = NET_PRIO_NORMAL;
+    blob->encrypt = false;
+    blob->oper = BLOB_SEND;
+    blob->group = OID_NIL;
+    blob->ctx = NULL;
 }
 
 static void blob_fini(blob_t *blob)
@@ -620,7 +966,34 @@ static void event_init(context_t *ctx)
 
     memset(evt, 0, sizeof(*evt));
     evt->data.ptr = ctx;
-    evt->events = EPOLLIN|EPOLLET|EPOLLERR;
+    if (ctx->connecting) {
+        evt->events = EPOLLOUT|EPOLLET|EPOLLERR;
+    } else {
+        evt->events = EPOLLIN|EPOLLET|EPOLLERR;
+    }
+}
+
+static void context_info(context_t *ctx)
+{
+    assert(ctx);
+
+    sprintf(ctx->peer.info, "%d <%d>%lld (%s:%d)",
+            ctx->peer.idx,
+            ctx->peer.sock,
+            ctx->peer.id,
+            (ctx->addr.ss_family == AF_INET6) ? ctx->peer.ipv6 : ctx->peer.ip,
+            ctx->peer.port);
+}
+
+static void context_notify(context_t *ctx, const char *name)
+{
+    assert(ctx && name);
+
+    recv_message_t *msg = recv_message_init(ctx);
+
+    msg->name = name;
+    msg->peer = ctx->peer.id;
+    s_recv_msgs.push(msg);
 }
 
 static context_t *context_init(int idx, oid_t peer, int fd,
@@ -633,21 +1006,29 @@ static context_t *context_init(int idx, oid_t peer, int fd,
     ctx->peer.sock = fd;
     strcpy(ctx->peer.ip, inet_ntoa(addr.sin_addr));
     ctx->peer.port = ntohs(addr.sin_port);
-    sprintf(ctx->peer.info, "%d <%d>%lld (%s:%d)",
-            ctx->peer.idx,
-            ctx->peer.sock,
-            ctx->peer.id,
-            ctx->peer.ip,
-            ctx->peer.port);
+    memset(&ctx->addr, 0, sizeof(ctx->addr));
+    memcpy(&ctx->addr, &addr, sizeof(addr));
+    ctx->addr_len = sizeof(addr);
+    context_info(ctx);
 
     ctx->last_time = ctx->start_time = time_s();
     ctx->close_time = 0;
     ctx->error_times = 0;
+    ctx->worker = ctx->peer.id & WORKER_THREAD_SIZE_MASK;
     ctx->recv_data = E_NEW blob_t;
     ctx->send_data = E_NEW blob_t;
     ctx->encipher = NULL;
     ctx->decipher = NULL;
     ctx->internal = false;
+    ctx->connecting = false;
+    ctx->connect_times = 0;
+    ctx->connect_time = 0;
+    ctx->retry_time = 0;
+    ctx->zerocopy_seq = 0;
+    ctx->fragment = false;
+    ctx->fragment_seq = 0;
+    ctx->fragment_size = 0;
+    set_zerocopy(ctx);
     blob_init(ctx->recv_data);
     blob_init(ctx->send_data);
     event_init(ctx);
@@ -657,13 +1038,6 @@ static context_t *context_init(int idx, oid_t peer, int fd,
         spin lock(&s_context_lock);
         s_contexts[ctx->peer.id] = ctx;
     }
-
-    recv_message_t *msg = recv_message_init(ctx);
-
-    msg->name = "Init.Req";
-    msg->peer = ctx->peer.id;
-    s_recv_msgs.push(msg);
-
     return ctx;
 }
 
@@ -677,21 +1051,29 @@ static context_t *context_init6(int idx, oid_t peer, int fd,
     ctx->peer.sock = fd;
     inet_ntop(AF_INET6, &addr.sin6_addr, ctx->peer.ipv6, sizeof(addr));
     ctx->peer.port = ntohs(addr.sin6_port);
-    sprintf(ctx->peer.info, "%d <%d>%lld (%s:%d)",
-            ctx->peer.idx,
-            ctx->peer.sock,
-            ctx->peer.id,
-            ctx->peer.ipv6,
-            ctx->peer.port);
+    memset(&ctx->addr, 0, sizeof(ctx->addr));
+    memcpy(&ctx->addr, &addr, sizeof(addr));
+    ctx->addr_len = sizeof(addr);
+    context_info(ctx);
 
     ctx->last_time = ctx->start_time = time_s();
     ctx->close_time = 0;
     ctx->error_times = 0;
+    ctx->worker = ctx->peer.id & WORKER_THREAD_SIZE_MASK;
     ctx->recv_data = E_NEW blob_t;
     ctx->send_data = E_NEW blob_t;
     ctx->encipher = NULL;
     ctx->decipher = NULL;
     ctx->internal = false;
+    ctx->connecting = false;
+    ctx->connect_times = 0;
+    ctx->connect_time = 0;
+    ctx->retry_time = 0;
+    ctx->zerocopy_seq = 0;
+    ctx->fragment = false;
+    ctx->fragment_seq = 0;
+    ctx->fragment_size = 0;
+    set_zerocopy(ctx);
     blob_init(ctx->recv_data);
     blob_init(ctx->send_data);
     event_init(ctx);
@@ -701,12 +1083,6 @@ static context_t *context_init6(int idx, oid_t peer, int fd,
         spin lock(&s_context_lock);
         s_contexts[ctx->peer.id] = ctx;
     }
-
-    recv_message_t *msg = recv_message_init(ctx);
-
-    msg->name = "Init.Req";
-    msg->peer = ctx->peer.id;
-    s_recv_msgs.push(msg);
     return ctx;
 }
 
@@ -727,16 +1103,31 @@ static void context_close(oid_t peer)
     if (ctx == NULL) {
         return;
     }
-    close(ctx->peer.sock);
 
-    recv_message_t *msg = recv_message_init(ctx);
+    mutex_lock(&(ctx->lock));
+    if (ctx->peer.sock >= 0) {
+        close(ctx->peer.sock);
+    }
 
-    msg->name = "Fini.Req";
-    msg->peer = peer;
-    s_recv_msgs.push(msg);
+    // never connected, nothing to finish
+    if (!ctx->connecting) {
+        context_notify(ctx, "Fini.Req");
+    }
 
+    // fd number may be reused, ignore queued events
     ctx->close_time = time_s();
+    ctx->peer.sock = -1;
+    ctx->connecting = false;
+    mutex_unlock(&(ctx->lock));
+
     s_free_contexts.push(ctx);
+
+    blob_t *oper = E_NEW blob_t;
+
+    blob_init(oper);
+    oper->oper = BLOB_GROUP_PURGE;
+    oper->ctx = ctx;
+    s_pending_write[ctx->worker].push(oper);
 }
 
 static void context_fini(context_t *ctx)
@@ -751,6 +1142,20 @@ static void context_fini(context_t *ctx)
             ctx->recv_data->total_size);
     blob_fini(ctx->send_data);
     blob_fini(ctx->recv_data);
+
+    // closed long ago, the kernel has done with the frames
+    zerocopy_queue::iterator itr = ctx->zerocopy_pending.begin();
+
+    for (; itr != ctx->zerocopy_pending.end(); ++itr) {
+        frame_fini(itr->second);
+    }
+    for (int i = 0; i < NET_PRIO_SIZE; ++i) {
+        blob_queue &q = ctx->send_units[i];
+
+        for (blob_queue::iterator itr_b = q.begin(); itr_b != q.end(); ++itr_b) {
+            blob_fini(*itr_b);
+        }
+    }
     cipher_fini(ctx->encipher);
     cipher_fini(ctx->decipher);
     E_DELETE(ctx);
@@ -790,27 +1195,125 @@ static void push_recv(context_t *ctx, chunk_queue &chunks)
 
 static void push_send(context_t *ctx, blob_t *msg)
 {
-    int idx = ctx->peer.sock & WORKER_THREAD_SIZE_MASK;
     msg->ctx = ctx;
-    s_pending_write[idx].push(msg);
+    s_pending_write[ctx->worker].push(msg);
+}
+
+///
+/// Split message into fragments of FRAGMENT_SIZE, shared frame viewed
+/// instead of copied.
+/// @return Total size of fragments.
+///
+static int append_fragments(context_t *ctx, blob_t *msg)
+{
+    blob_queue &q = ctx->send_units[msg->prio];
+    chunk_queue::iterator itr = msg->chunks.begin();
+    int stream = ctx->fragment_seq++;
+    int rem = msg->total_size;
+    int offset = 0; // offset in current chunk
+    int sum = 0;
+
+    while (rem > 0) {
+        int len = std::min(rem, FRAGMENT_SIZE);
+        int head[3] = {
+            len + SIZE_INTX2 + SIZE_INT,
+            FRAGMENT_FLAG | ((len == rem) ? FRAGMENT_LAST : 0),
+            stream,
+        };
+        blob_t *frag = E_NEW blob_t;
+
+        blob_init(frag);
+        frag->prio = msg->prio;
+        frag->total_size = head[0];
+        frag->chunks.push_back(chunk_init((const char *)head, sizeof(head)));
+        rem -= len;
+        while (len > 0) {
+            chunk_t *c = *itr;
+            int real = std::min(c->data_size - offset, len);
+
+            if (c->frame != NULL) {
+                frag->chunks.push_back(chunk_init(c->frame,
+                            c->offset + offset, real));
+            } else {
+                frag->chunks.push_back(chunk_init(c->data + offset, real));
+            }
+            len -= real;
+            offset += real;
+            if (offset == c->data_size) {
+                ++itr;
+                offset = 0;
+            }
+        }
+        sum += frag->total_size;
+        q.push_back(frag);
+    }
+    blob_fini(msg);
+    return sum;
+}
+
+///
+/// Encipher message, in writer thread to keep the order of cipher
+/// stream same as sending.
+///
+static void message_encrypt(context_t *ctx, blob_t *msg)
+{
+    cipher_t *encipher = ctx->encipher;
+
+    if (encipher == NULL) {
+        return;
+    }
+
+    std::string buf;
+    chunk_queue::iterator itr = msg->chunks.begin();
+
+    buf.reserve(msg->total_size);
+    for (; itr != msg->chunks.end(); ++itr) {
+        chunk_t *c = *itr;
+
+        buf.append(chunk_data(c), c->wr_offset);
+        chunk_fini(c);
+    }
+    msg->chunks.clear();
+
+    char *data = &buf[0];
+    int name_len = 0;
+
+    memcpy(&name_len, data + SIZE_INT, SIZE_INT);
+
+    int body_len = msg->total_size - SIZE_INTX2 - name_len;
+
+    data += SIZE_INTX2;
+    encipher->codec(encipher->ctx, (uint8_t*)data, (size_t)name_len);
+    encipher->codec(encipher->ctx, (uint8_t*)data + name_len, (size_t)body_len);
+    name_len |= ENCRYPT_FLAG;
+    memcpy(&buf[SIZE_INT], &name_len, SIZE_INT);
+    chunks_push(msg->chunks, buf.data(), buf.size());
 }
 
 static void append_send(context_t *ctx, blob_t *msg)
 {
     assert(ctx && msg);
+    if (msg->encrypt) {
+        message_encrypt(ctx, msg);
+    }
     chunk_queue::const_iterator itr = msg->chunks.begin();
     for (; itr != msg->chunks.end(); ++itr) {
         chunk_t *c = *itr;
 
         c->data_size = c->wr_offset;
-        ctx->send_data->chunks.push_back(c);
     }
-    msg->chunks.clear();
-    ctx->send_data->pending_size += msg->total_size;
-    ctx->send_data->total_size += msg->total_size;
 
-    ++s_stat.send_msg_num;
-    s_stat.send_msg_size += msg->total_size;
+    int size = msg->total_size;
+
+    stat_add(STAT_SEND_MSG_NUM, 1);
+    stat_add(STAT_SEND_MSG_SIZE, size);
+    if (ctx->fragment && size > FRAGMENT_SIZE) {
+        size = append_fragments(ctx, msg);
+    } else {
+        ctx->send_units[msg->prio].push_back(msg);
+    }
+    ctx->send_data->pending_size += size;
+    ctx->send_data->total_size += size;
 }
 
 static void push_send(context_t *ctx, chunk_queue &chunks)
@@ -824,17 +1327,127 @@ static void push_send(context_t *ctx, chunk_queue &chunks)
     }
 }
 
-static chunk_t *pop_send(context_t *ctx, chunk_queue &clone)
+///
+/// Pop chunks to be sent, the unfinished first(can't be interleaved),
+/// then msgs/fragments of higher priority within SEND_BUDGET.
+///
+static void pop_send(context_t *ctx, chunk_queue &clone)
 {
     assert(ctx);
 
-    chunk_t *c = NULL;
-    chunk_queue &src = ctx->send_data->chunks;
-    for (size_t i = 0; i < CHUNK_MAX_NUM && !src.empty(); ++i) {
-        clone.push_back(src.front());
-        src.pop_front();
+    int budget = SEND_BUDGET;
+
+    clone.splice(clone.end(), ctx->send_data->chunks);
+    for (int i = 0; i < NET_PRIO_SIZE && budget > 0; ++i) {
+        blob_queue &q = ctx->send_units[i];
+
+        while (!q.empty() && budget > 0) {
+            blob_t *msg = q.front();
+
+            q.pop_front();
+            budget -= msg->total_size;
+            clone.splice(clone.end(), msg->chunks);
+            blob_fini(msg);
+        }
     }
-    return c;
+}
+
+static void group_leave(group_map &groups, group_map::iterator itr,
+        context_t *ctx)
+{
+    member_array &members = itr->second;
+    member_array::iterator itr_m = std::find(members.begin(),
+            members.end(), ctx);
+
+    if (itr_m != members.end()) {
+        *itr_m = members.back();
+        members.pop_back();
+    }
+    if (members.empty()) {
+        groups.erase(itr);
+    }
+}
+
+///
+/// Fan out shared frame to members in the group.
+///
+static void group_send(group_map &groups, blob_t *msg,
+        context_map &pending_ctxs)
+{
+    group_map::iterator itr = groups.find(msg->group);
+
+    if (itr == groups.end()) {
+        return;
+    }
+
+    member_array &members = itr->second;
+    frame_t *frame = msg->chunks.front()->frame;
+
+    for (size_t i = 0; i < members.size(); ++i) {
+        context_t *ctx = members[i];
+        blob_t *m = NULL;
+
+        if (ctx->close_time != 0) {
+            continue;
+        }
+        m = E_NEW blob_t;
+        blob_init(m);
+        m->total_size = msg->total_size;
+        m->chunks.push_back(chunk_init(frame, 0, frame->size));
+        if (ctx->encipher == NULL) {
+            m->prio = msg->prio;
+        } else {
+            m->encrypt = true;
+        }
+        append_send(ctx, m);
+        pending_ctxs[ctx->peer.id] = ctx;
+    }
+}
+
+static void group_oper(group_map &groups, blob_t *msg,
+        context_map &pending_ctxs)
+{
+    group_map::iterator itr;
+
+    switch (msg->oper) {
+    case BLOB_GROUP_JOIN:
+        {
+            member_array &members = groups[msg->group];
+
+            if (std::find(members.begin(), members.end(), msg->ctx)
+                    == members.end()) {
+                members.push_back(msg->ctx);
+            }
+        }
+        break;
+    case BLOB_GROUP_LEAVE:
+        itr = groups.find(msg->group);
+        if (itr != groups.end()) {
+            group_leave(groups, itr, msg->ctx);
+        }
+        break;
+    case BLOB_GROUP_SEND:
+        group_send(groups, msg, pending_ctxs);
+        break;
+    case BLOB_GROUP_PURGE:
+        for (itr = groups.begin(); itr != groups.end();) {
+            group_leave(groups, itr++, msg->ctx);
+        }
+        break;
+    default:
+        assert(0);
+    }
+    blob_fini(msg);
+}
+
+static bool send_pending(context_t *ctx)
+{
+    for (int i = 0; i < NET_PRIO_SIZE; ++i) {
+        if (!ctx->send_units[i].empty()) {
+            return true;
+        }
+    }
+    return false;
 }
 
 int net_init(void)
@@ -847,6 +1460,8 @@ int net_init(void)
     }
     spin_init(&s_context_lock);
     spin_init(&s_pre_context_lock);
+    spin_init(&s_connect_lock);
+    s_stat_time = time_mono();
     s_tid = thread_init(net_thread, NULL);
 
     for (int i = 0; i < WORKER_THREAD_SIZE; i++) {
@@ -864,6 +1479,7 @@ int net_init(void)
 int net_fini(void)
 {
     MODULE_IMPORT_SWITCH;
+    spin_fini(&s_connect_lock);
     spin_fini(&s_pre_context_lock);
     spin_fini(&s_context_lock);
     close(s_epoll);
@@ -874,6 +1490,11 @@ void net_encrypt(encrypt_func encry, encrypt_func decry)
 {
 }
 
+void net_zerocopy(int size)
+{
+    s_zerocopy_size = std::max(size, 0);
+}
+
 
 static int set_reuseaddr(int fd)
 {
@@ -968,75 +1589,181 @@ int net_listen6(const std::string &name, const std::string &ip, int port)
 int net_connect(int idx, oid_t peer, const std::string &name,
         const std::string &ip, int port)
 {
-    int fd = socket(AF_INET, SOCK_STREAM, 0);
     struct sockaddr_in addr;
-    socklen_t len = sizeof(addr);
 
     memset(&addr, 0, sizeof(addr));
     addr.sin_family = AF_INET;
-    inet_aton(ip.c_str(), &(addr.sin_addr));
-    addr.sin_port = htons(port);
-
-    if (0 != connect(fd, (struct sockaddr *)(&addr), sizeof(addr))) {
-        LOG_INFO("net", "[%s] (%s:%d) connect FAILED: %s.",
-                name.c_str(), ip.c_str(), port,
-                strerror(errno));
-        close(fd);
+    if (0 == inet_aton(ip.c_str(), &(addr.sin_addr))) {
+        LOG_ERROR("net", "[%s] (%s:%d) INVALID address.",
+                name.c_str(), ip.c_str(), port);
         return -1;
     }
+    addr.sin_port = htons(port);
 
-    // @todo ON_CONNECT
-    set_nonblock(fd);
-    getsockname(fd, (struct sockaddr *)(&addr), &len);
-    context_t *ctx = context_init(idx, peer, fd, addr);
+    context_t *ctx = context_init(idx, peer, -1, addr);
 
     ctx->internal = true;
-    if (0 != epoll_ctl(s_epoll, EPOLL_CTL_ADD, fd, &(ctx->evt))) {
-        LOG_ERROR("net", "[%s] (%s:%d) epoll_ctl FAILED: %s.",
-                name.c_str(), ip.c_str(), port,
-                strerror(errno));
-        net_close(ctx->peer.id);
-        return -1;
-    }
+    ctx->connecting = true;
+    mutex_lock(&(ctx->lock));
+    connect_start(ctx);
+    mutex_unlock(&(ctx->lock));
     return 0;
 }
 
 int net_connect6(int idx, oid_t peer, const std::string &name,
         const std::string &ip, int port)
 {
-    int fd = socket(AF_INET6, SOCK_STREAM, 0);
     struct sockaddr_in6 addr;
-    socklen_t len = sizeof(addr);
 
     memset(&addr, 0, sizeof(addr));
     addr.sin6_family = AF_INET6;
-    inet_pton(AF_INET6, ip.c_str(), &(addr.sin6_addr));
+    if (1 != inet_pton(AF_INET6, ip.c_str(), &(addr.sin6_addr))) {
+        LOG_ERROR("net", "[%s] (%s:%d) INVALID address.",
+                name.c_str(), ip.c_str(), port);
+        return -1;
+    }
     addr.sin6_port = htons(port);
 
-    if (0 != connect(fd, (struct sockaddr *)(&addr), sizeof(addr))) {
-        LOG_INFO("net", "[%s] (%s:%d) connect FAILED: %s.",
-                name.c_str(), ip.c_str(), port,
+    context_t *ctx = context_init6(idx, peer, -1, addr);
+
+    ctx->internal = true;
+    ctx->connecting = true;
+    mutex_lock(&(ctx->lock));
+    connect_start(ctx);
+    mutex_unlock(&(ctx->lock));
+    return 0;
+}
+
+///
+/// Start connecting (non-blocking), `ctx->lock` MUST be held.
+/// Completed by `on_connect` in io thread, or `connect_fail`.
+///
+static int connect_start(context_t *ctx)
+{
+    assert(ctx && ctx->connecting);
+
+    int fd = socket(ctx->addr.ss_family, SOCK_STREAM, 0);
+
+    if (fd < 0) {
+        LOG_ERROR("net", "%s socket FAILED: %s.",
+                ctx->peer.info,
                 strerror(errno));
-        close(fd);
+        connect_fail(ctx);
         return -1;
     }
 
-    // @todo ON_CONNECT
     set_nonblock(fd);
-    getsockname(fd, (struct sockaddr *)(&addr), &len);
-    context_t *ctx = context_init6(idx, peer, fd, addr);
+    ctx->peer.sock = fd;
+    ctx->connect_time = time_mono();
+    set_zerocopy(ctx);
+    context_info(ctx);
+    event_init(ctx);
 
-    ctx->internal = true;
+    {
+        spin lock(&s_connect_lock);
+        s_connecting.insert(ctx->peer.id);
+    }
+
+    if (0 != connect(fd, (struct sockaddr *)(&ctx->addr), ctx->addr_len)
+            && errno != EINPROGRESS) {
+        LOG_INFO("net", "%s connect FAILED: %s.",
+                ctx->peer.info,
+                strerror(errno));
+        connect_fail(ctx);
+        return -1;
+    }
+
+    // connected or failed, EPOLLOUT is triggered
     if (0 != epoll_ctl(s_epoll, EPOLL_CTL_ADD, fd, &(ctx->evt))) {
-        LOG_ERROR("net", "[%s] (%s:%d) epoll_ctl FAILED: %s.",
-                name.c_str(), ip.c_str(), port,
+        LOG_ERROR("net", "%s epoll_ctl FAILED: %s.",
+                ctx->peer.info,
                 strerror(errno));
-        net_close(ctx->peer.id);
+        connect_fail(ctx);
         return -1;
     }
     return 0;
 }
 
+///
+/// Connecting failed, retry later with jittered exponential backoff.
+/// `ctx->lock` MUST be held.
+///
+static void connect_fail(context_t *ctx)
+{
+    assert(ctx && ctx->connecting);
+
+    if (ctx->peer.sock >= 0) {
+        epoll_ctl(s_epoll, EPOLL_CTL_DEL, ctx->peer.sock, &(ctx->evt));
+        close(ctx->peer.sock);
+        ctx->peer.sock = -1;
+    }
+
+    time64_t delay = CONNECT_RETRY_MAX;
+
+    if (ctx->connect_times < 16) {
+        delay = std::min(CONNECT_RETRY_MIN << ctx->connect_times,
+                CONNECT_RETRY_MAX);
+    }
+    delay = delay / 2 + rand(0, (int)(delay / 2));
+    ++(ctx->connect_times);
+    ctx->connect_time = 0;
+    ctx->retry_time = time_mono() + delay;
+    LOG_INFO("net", "%s connect FAILED %d times, retry in %lld ms.",
+            ctx->peer.info,
+            ctx->connect_times,
+            delay);
+    context_notify(ctx, "Fail.Req");
+}
+
+///
+/// Check connecting timeout and retry failed connections.
+/// Run in context thread.
+///
+static void connect_update(void)
+{
+    context_set peers;
+    context_set::iterator itr;
+
+    {
+        spin lock(&s_connect_lock);
+        if (s_connecting.empty()) {
+            return;
+        }
+        peers = s_connecting;
+    }
+
+    time64_t ct = time_mono();
+
+    for (itr = peers.begin(); itr != peers.end(); ++itr) {
+        context_t *ctx = context_find(*itr);
+        bool done = true;
+
+        if (ctx != NULL) {
+            mutex_lock(&(ctx->lock));
+            if (!ctx->connecting) {
+                // connected
+            } else if (ctx->peer.sock < 0) {
+                done = false;
+                if (ct >= ctx->retry_time) {
+                    connect_start(ctx);
+                }
+            } else if (ct - ctx->connect_time >= CONNECT_TIMEOUT) {
+                done = false;
+                LOG_INFO("net", "%s connect TIMEOUT.",
+                        ctx->peer.info);
+                connect_fail(ctx);
+            } else {
+                done = false;
+            }
+            mutex_unlock(&(ctx->lock));
+        }
+        if (done) {
+            spin lock(&s_connect_lock);
+            s_connecting.erase(*itr);
+        }
+    }
+}
+
 void net_close(oid_t peer)
 {
     if (peer <= 0) {
@@ -1065,50 +1792,51 @@ int net_proc(void)
 
 static void net_stat_detail(int flag)
 {
-    LOG_INFO("stat", "send msg: %d(%d), recv msg: %d(%d), contexts: %d/%d",
-            s_stat.send_msg_num,
-            s_stat.send_msg_size,
-            s_stat.recv_msg_num,
-            s_stat.recv_msg_size,
-            s_stat.context_size_created,
-            s_stat.context_size_released,
-            s_stat.chunk_size_created,
-            s_stat.chunk_size_released);
-
-    stat_msg_t *sm = NULL;
-    msg_map::iterator itr;
-
-    if (flag & NET_STAT_REQ) {
-        msg_map &msgs = s_stat.req_msgs;
-
-        for (itr = msgs.begin(); itr != msgs.end(); ++itr) {
-            sm = itr->second;
-            LOG_INFO("stat", "  %s> msg num: %d, msg size: %d",
-                    itr->first.c_str(),
-                    sm->msg_num,
-                    sm->msg_size);
-            E_DELETE(sm);
-        }
-        msgs.clear();
-    }
-
-    if (flag & NET_STAT_RES) {
-        msg_map &msgs = s_stat.res_msgs;
-
-        for (itr = msgs.begin(); itr != msgs.end(); ++itr) {
-            sm = itr->second;
-            LOG_INFO("stat", "  %s> msg num: %d, msg size: %d",
-                    itr->first.c_str(),
-                    sm->msg_num,
-                    sm->msg_size);
-            E_DELETE(sm);
+    uint64_t cur[STAT_SIZE];
+    uint64_t d[STAT_SIZE];
+    time64_t ct = time_mono();
+    double elapsed = (ct > s_stat_time) ? (ct - s_stat_time) / 1000.0 : 1.0;
+
+    stat_merge(cur);
+    for (int i = 0; i < STAT_SIZE; ++i) {
+        d[i] = cur[i] - s_stat_last[i];
+    }
+    LOG_INFO("stat", "send msg: %llu(%llu) %.1f/s %.1fKB/s"
+            ", recv msg: %llu(%llu) %.1f/s %.1fKB/s"
+            ", contexts: %llu/%llu, chunks: %llu/%llu, zerocopy: %llu/%llu",
+            d[STAT_SEND_MSG_NUM],
+            d[STAT_SEND_MSG_SIZE],
+            d[STAT_SEND_MSG_NUM] / elapsed,
+            d[STAT_SEND_MSG_SIZE] / elapsed / 1024,
+            d[STAT_RECV_MSG_NUM],
+            d[STAT_RECV_MSG_SIZE],
+            d[STAT_RECV_MSG_NUM] / elapsed,
+            d[STAT_RECV_MSG_SIZE] / elapsed / 1024,
+            cur[STAT_CONTEXT_CREATED],
+            cur[STAT_CONTEXT_RELEASED],
+            cur[STAT_CHUNK_CREATED],
+            cur[STAT_CHUNK_RELEASED],
+            cur[STAT_ZEROCOPY_SENT],
+            cur[STAT_ZEROCOPY_COPIED]);
+
+    stat_msg_map::iterator itr = s_stat_msgs.begin();
+
+    for (; itr != s_stat_msgs.end(); ++itr) {
+        stat_msg_t *sm = itr->second;
+        uint64_t num = sm->msg_num - sm->last_num;
+
+        if (num == 0 || (flag & sm->type) == 0) {
+            continue;
         }
-        msgs.clear();
+        LOG_INFO("stat", "  %s> msg num: %llu, msg size: %llu",
+                sm->name.c_str(),
+                num,
+                sm->msg_size - sm->last_size);
+        sm->last_num = sm->msg_num;
+        sm->last_size = sm->msg_size;
     }
-    s_stat.send_msg_num = 0;
-    s_stat.send_msg_size = 0;
-    s_stat.recv_msg_num = 0;
-    s_stat.recv_msg_size = 0;
+    memcpy(s_stat_last, cur, sizeof(cur));
+    s_stat_time = ct;
 }
 
 void net_stat(int flag)
@@ -1133,39 +1861,54 @@ void net_stat(int flag)
     }
 }
 
-void net_stat_message(const recv_message_t &msg)
+stat_msg_t *net_stat_slot(const std::string &name)
+{
+    stat_msg_map::iterator itr = s_stat_msgs.find(name);
+
+    if (itr != s_stat_msgs.end()) {
+        return itr->second;
+    }
+
+    stat_msg_t *sm = E_NEW stat_msg_t;
+
+    sm->name = name;
+    if (name.find(".Res") != std::string::npos) {
+        sm->type = NET_STAT_RES;
+    } else if (name.find(".Req") != std::string::npos) {
+        sm->type = NET_STAT_REQ;
+    } else {
+        sm->type = NET_STAT_NONE;
+    }
+    sm->msg_num = 0;
+    sm->msg_size = 0;
+    sm->last_num = 0;
+    sm->last_size = 0;
+    s_stat_msgs.insert(std::make_pair(name, sm));
+    return sm;
+}
+
+void net_stat_message(const recv_message_t &msg, stat_msg_t *slot)
 {
-    msg_map::iterator itr;
+    assert(slot);
+
+    if (slot->type == NET_STAT_NONE) {
+        LOG_WARN("net", "INVALID message type: %s.",
+                msg.name.c_str());
+        return;
+    }
+
+    int size = msg.body.size();
 
+    ++slot->msg_num;
+    slot->msg_size += size;
+    stat_add(STAT_RECV_MSG_NUM, 1);
+    stat_add(STAT_RECV_MSG_SIZE, size);
+}
+
+void net_stat_message(const recv_message_t &msg)
+{
     if (msg.pb != NULL) {
-        stat_msg_t *sm = NULL;
-        int size = msg.pb->ByteSize();
-
-        if (msg.name.find(".Res") != std::string::npos) {
-            itr = s_stat.res_msgs.find(msg.name);
-            if (itr == s_stat.res_msgs.end()) {
-                sm = E_NEW stat_msg_t;
-                s_stat.res_msgs.insert(std::make_pair(msg.name, sm));
-            } else {
-                sm = itr->second;
-            }
-        } else if (msg.name.find(".Req") != std::string::npos) {
-            itr = s_stat.req_msgs.find(msg.name);
-            if (itr == s_stat.req_msgs.end()) {
-                sm = E_NEW stat_msg_t;
-                s_stat.req_msgs.insert(std::make_pair(msg.name, sm));
-            } else {
-                sm = itr->second;
-            }
-        } else {
-            LOG_WARN("net", "INVALID message type: %s.",
-                    msg.name.c_str());
-            return;
-        }
-        sm->msg_num++;
-        sm->msg_size += size;
-        s_stat.recv_msg_num++;
-        s_stat.recv_msg_size += size;
+        net_stat_message(msg, net_stat_slot(msg.name));
     }
 }
 
@@ -1215,7 +1958,13 @@ void net_encode(const pb_t &pb, std::string &name, std::string &body)
     pb.SerializeToString(&body);
 }
 
-blob_t *net_encode(oid_t peer, const std::string &pb_name, const std::string &pb_body)
+///
+/// Encode message of given priority, enciphered by writer thread if the
+/// peer has encipher now.
+/// @param prio Priority, enciphered messages are kept in order(normal).
+///
+static blob_t *net_encode(oid_t peer, const std::string &pb_name,
+        const std::string &pb_body, int prio)
 {
     context_t *ctx = context_find(peer);
     blob_t *msg = E_NEW blob_t;
@@ -1226,40 +1975,63 @@ blob_t *net_encode(oid_t peer, const std::string &pb_name, const std::string &pb
     }
 
     blob_init(msg);
+    if (encipher == NULL) {
+        msg->prio = prio;
+    } else {
+        msg->encrypt = true;
+    }
 
     int name_len = pb_name.size();
     int body_len = pb_body.size();
 
     msg->total_size = name_len + body_len + SIZE_INTX2;
     chunks_push(msg->chunks, &(msg->total_size), SIZE_INT);
-    if (encipher != NULL) {
-        int len = name_len | ENCRYPT_FLAG;
-        chunks_push(msg->chunks, &len, SIZE_INT);
-    } else {
-        chunks_push(msg->chunks, &name_len, SIZE_INT);
-    }
-    if (encipher != NULL) { // encrypt
-        char *name = (char *)E_ALLOC(name_len);
-        char *body = (char *)E_ALLOC(body_len);
-
-        memcpy(name, pb_name.data(), name_len);
-        memcpy(body, pb_body.data(), body_len);
-        encipher->codec(encipher->ctx, (uint8_t*)name, (size_t)name_len);
-        encipher->codec(encipher->ctx, (uint8_t*)body, (size_t)body_len);
-        chunks_push(msg->chunks, name, name_len);
-        chunks_push(msg->chunks, body, body_len);
-        E_FREE(name);
-        E_FREE(body);
-    } else {
-        const char *name = pb_name.data();
-        chunks_push(msg->chunks, name, name_len);
-        chunks_push(msg->chunks, pb_body.data(), body_len);
-    }
+    chunks_push(msg->chunks, &name_len, SIZE_INT);
+    chunks_push(msg->chunks, pb_name.data(), name_len);
+    chunks_push(msg->chunks, pb_body.data(), body_len);
     LOG_TRACE("net", "<- %s.",
             pb_name.c_str());
     return msg;
 }
 
+blob_t *net_encode(oid_t peer, const std::string &pb_name, const std::string &pb_body)
+{
+    return net_encode(peer, pb_name, pb_body, msg_priority(pb_name));
+}
+
+///
+/// Encode message referencing shared frame for zerocopy if possible.
+/// @param prio Priority.
+/// @param[in out] frame Shared frame, created if NULL.
+///
+static blob_t *net_encode(oid_t peer, const std::string &pb_name,
+        const std::string &pb_body, int prio, frame_t **frame)
+{
+    assert(frame);
+
+    int size = pb_name.size() + pb_body.size() + SIZE_INTX2;
+
+    if (s_zerocopy_size > 0 && size >= s_zerocopy_size) {
+        context_t *ctx = context_find(peer);
+
+        if (ctx != NULL && ctx->zerocopy && ctx->encipher == NULL) {
+            blob_t *msg = E_NEW blob_t;
+
+            if (*frame == NULL) {
+                *frame = frame_init(pb_name, pb_body);
+            }
+            blob_init(msg);
+            msg->prio = prio;
+            msg->total_size = size;
+            msg->chunks.push_back(chunk_init(*frame, 0, size));
+            LOG_TRACE("net", "<- %s.",
+                    pb_name.c_str());
+            return msg;
+        }
+    }
+    return net_encode(peer, pb_name, pb_body, prio);
+}
+
 blob_t *net_encode(oid_t peer, const pb_t &pb)
 {
 
@@ -1293,7 +2065,7 @@ bool net_decode(recv_message_t *msg)
                 msg->name.c_str());
     }
 
-    ctx->last_time = time_s();
+    ctx->last_time = time_frame_s();
     return true;
 }
 
@@ -1313,9 +2085,13 @@ int net_send(oid_t peer, blob_t *msg)
 
 void net_send(oid_t peer, const pb_t &pb)
 {
-    blob_t *msg = net_encode(peer, pb);
+    std::string name;
+    std::string body;
+    frame_t *frame = NULL;
 
-    net_send(peer, msg);
+    net_encode(pb, name, body);
+    net_send(peer, net_encode(peer, name, body, msg_priority(name), &frame));
+    frame_fini(frame);
 }
 
 void net_send(const id_set &peers, const pb_t &pb)
@@ -1324,13 +2100,17 @@ void net_send(const id_set &peers, const pb_t &pb)
 
     std::string name;
     std::string body;
+    frame_t *frame = NULL;
     net_encode(pb, name, body);
 
+    int prio = msg_priority(name);
+
     id_set::const_iterator itr = peers.begin();
     for (; itr != peers.end(); ++itr) {
-        blob_t *msg = net_encode(*itr, name, body);
+        blob_t *msg = net_encode(*itr, name, body, prio, &frame);
         net_send(*itr, msg);
     }
+    frame_fini(frame);
 }
 
 void net_send(const obj_map_id &peers, const pb_t &pb)
@@ -1339,13 +2119,17 @@ void net_send(const obj_map_id &peers, const pb_t &pb)
 
     std::string name;
     std::string body;
+    frame_t *frame = NULL;
     net_encode(pb, name, body);
 
+    int prio = msg_priority(name);
+
     obj_map_id::const_iterator itr = peers.begin();
     for (; itr != peers.end(); ++itr) {
-        blob_t *msg = net_encode(itr->first, name, body);
+        blob_t *msg = net_encode(itr->first, name, body, prio, &frame);
         net_send(itr->first, msg);
     }
+    frame_fini(frame);
 }
 
 void net_send(const pb_map_id &peers, const pb_t &pb)
@@ -1354,13 +2138,17 @@ void net_send(const pb_map_id &peers, const pb_t &pb)
 
     std::string name;
     std::string body;
+    frame_t *frame = NULL;
     net_encode(pb, name, body);
 
+    int prio = msg_priority(name);
+
     pb_map_id::const_iterator itr = peers.begin();
     for (; itr != peers.end(); ++itr) {
-        blob_t *msg = net_encode(itr->first, name, body);
+        blob_t *msg = net_encode(itr->first, name, body, prio, &frame);
         net_send(itr->first, msg);
     }
+    frame_fini(frame);
 }
 
 void net_send(const id_limap &peers, const pb_t &pb)
@@ -1369,13 +2157,17 @@ void net_send(const id_limap &peers, const pb_t &pb)
 
     std::string name;
     std::string body;
+    frame_t *frame = NULL;
     net_encode(pb, name, body);
 
+    int prio = msg_priority(name);
+
     id_limap::const_iterator itr = peers.begin();
     for (; itr != peers.end(); ++itr) {
-        blob_t *msg = net_encode(itr->first, name, body);
+        blob_t *msg = net_encode(itr->first, name, body, prio, &frame);
         net_send(itr->first, msg);
     }
+    frame_fini(frame);
 }
 
 void net_send(const id_ilmap &peers, const pb_t &pb)
@@ -1384,13 +2176,17 @@ void net_send(const id_ilmap &peers, const pb_t &pb)
 
     std::string name;
     std::string body;
+    frame_t *frame = NULL;
     net_encode(pb, name, body);
 
+    int prio = msg_priority(name);
+
     id_ilmap::const_iterator itr = peers.begin();
     for (; itr != peers.end(); ++itr) {
-        blob_t *msg = net_encode(itr->second, name, body);
+        blob_t *msg = net_encode(itr->second, name, body, prio, &frame);
         net_send(itr->second, msg);
     }
+    frame_fini(frame);
 }
 
 void net_rawsend(oid_t peer, const std::string &name, const std::string &body)
@@ -1399,6 +2195,60 @@ void net_rawsend(oid_t peer, const std::string &name, const std::string &body)
     net_send(peer, msg);
 }
 
+///
+/// Push group operation to the writer thread of peer.
+///
+static void group_push(oid_t group, oid_t peer, int oper)
+{
+    context_t *ctx = context_find(peer);
+
+    if (ctx == NULL) {
+        return;
+    }
+
+    blob_t *msg = E_NEW blob_t;
+
+    blob_init(msg);
+    msg->oper = oper;
+    msg->group = group;
+    push_send(ctx, msg);
+}
+
+void net_group_join(oid_t group, oid_t peer)
+{
+    group_push(group, peer, BLOB_GROUP_JOIN);
+}
+
+void net_group_leave(oid_t group, oid_t peer)
+{
+    group_push(group, peer, BLOB_GROUP_LEAVE);
+}
+
+void net_group_send(oid_t group, const pb_t &pb)
+{
+    std::string name;
+    std::string body;
+    net_encode(pb, name, body);
+
+    int prio = msg_priority(name);
+    frame_t *frame = frame_init(name, body);
+
+    for (int i = 0; i < WORKER_THREAD_SIZE; ++i) {
+        blob_t *msg = E_NEW blob_t;
+
+        blob_init(msg);
+        msg->oper = BLOB_GROUP_SEND;
+        msg->group = group;
+        msg->prio = prio;
+        msg->total_size = frame->size;
+        msg->chunks.push_back(chunk_init(frame, 0, frame->size));
+        s_pending_write[i].push(msg);
+    }
+    frame_fini(frame);
+    LOG_TRACE("net", "<- %s.",
+            name.c_str());
+}
+
 static void on_accept6(const epoll_event &evt)
 {
     struct sockaddr_in6 addr;
@@ -1417,6 +2267,7 @@ static void on_accept6(const epoll_event &evt)
         context_t *ctx = context_init6(0, OID_NIL, fd, addr);
 
         LOG_DEBUG("net", "%s", "accept new connection...");
+        context_notify(ctx, "Init.Req");
 
         if (0 != epoll_ctl(s_epoll, EPOLL_CTL_ADD, fd, &(ctx->evt))) {
             LOG_ERROR("net", "%s epoll_ctl FAILED: %s.",
@@ -1433,13 +2284,64 @@ static void on_accept6(const epoll_event &evt)
     }
 }
 
+static void on_connect(const epoll_event &evt)
+{
+    context_t *ctx = static_cast<context_t *>(evt.data.ptr);
+    int err = 0;
+    socklen_t len = sizeof(err);
+
+    assert(ctx);
+    mutex_lock(&(ctx->lock));
+    if (!ctx->connecting || ctx->peer.sock < 0) {
+        // stale event of closed socket
+        mutex_unlock(&(ctx->lock));
+        return;
+    }
+    if (0 != getsockopt(ctx->peer.sock, SOL_SOCKET, SO_ERROR, &err, &len)) {
+        err = errno;
+    }
+    if (err != 0) {
+        LOG_INFO("net", "%s connect FAILED: %s.",
+                ctx->peer.info,
+                strerror(err));
+        connect_fail(ctx);
+        mutex_unlock(&(ctx->lock));
+        return;
+    }
+
+    struct sockaddr_storage addr;
+
+    len = sizeof(addr);
+    if (0 != getpeername(ctx->peer.sock, (struct sockaddr *)(&addr), &len)) {
+        // stale event, still in progress
+        mutex_unlock(&(ctx->lock));
+        return;
+    }
+
+    ctx->connecting = false;
+    ctx->connect_times = 0;
+    ctx->last_time = time_s();
+    event_init(ctx);
+    if (0 != epoll_ctl(s_epoll, EPOLL_CTL_MOD, ctx->peer.sock, &(ctx->evt))) {
+        LOG_ERROR("net", "%s epoll_ctl FAILED: %s.",
+                ctx->peer.info,
+                strerror(errno));
+        mutex_unlock(&(ctx->lock));
+        net_close(ctx->peer.id);
+        return;
+    }
+    LOG_INFO("net", "%s is CONNECTED.",
+            ctx->peer.info);
+    context_notify(ctx, "Init.Req");
+    mutex_unlock(&(ctx->lock));
+}
+
 static void on_read(const epoll_event &evt)
 {
     context_t *ctx = static_cast<context_t *>(evt.data.ptr);
 
     if (ctx != NULL) {
-        int idx = ctx->peer.sock & WORKER_THREAD_SIZE_MASK;
-        s_pending_read[idx].push(ctx);
+        s_pending_read[ctx->worker].push(ctx);
     }
 }
 
@@ -1449,7 +2351,7 @@ static void on_read(context_t *ctx)
     int sock = ctx->peer.sock;
     chunk_queue chunks;
 
-    static char buf[CHUNK_SIZE_L];
+    char buf[CHUNK_SIZE_L]; // NOT static, shared by reader threads
     while (size > 0) {
         size = recv(sock, buf, sizeof(buf), 0);
 
@@ -1506,46 +2408,77 @@ static bool on_write(context_t *ctx)
 {
     chunk_queue chunks;
 
-    pop_send(ctx, chunks);
+    // zerocopy frames are released with context
+    if (ctx->close_time != 0) {
+        return true;
+    }
+
+    // keep pending until connected
+    if (ctx->connecting) {
+        return false;
+    }
+    if (!ctx->zerocopy_pending.empty()) {
+        zerocopy_reap(ctx);
+    }
 
     oid_t cid = ctx->peer.id;
     int sock = ctx->peer.sock;
     int sum = 0;
     bool done = true;
-    chunk_queue::iterator itr = chunks.begin();
-    while (itr != chunks.end()) {
-        chunk_t *c = *itr;
-        int rem = c->data_size - c->rd_offset;
-
-        while (rem > 0) {
-            int num = send(sock, c->data + c->rd_offset, rem, 0);
-            if (num < 0) {
-                ctx = context_find(cid);
-                if (ctx == NULL) { // context has destroyed
-                    break;
+    chunk_queue::iterator itr;
+
+    do {
+        pop_send(ctx, chunks);
+        itr = chunks.begin();
+        while (itr != chunks.end()) {
+            chunk_t *c = *itr;
+            int rem = c->data_size - c->rd_offset;
+
+            while (rem > 0) {
+                char *buf = chunk_data(c) + c->rd_offset;
+                int num = 0;
+
+                if (c->frame != NULL && ctx->zerocopy
+                    && c->frame->size >= s_zerocopy_size) {
+                    num = send(sock, buf, rem, MSG_ZEROCOPY);
+                    if (num > 0) {
+                        ctx->zerocopy_pending.push_back(std::make_pair(
+                                    ctx->zerocopy_seq++, frame_ref(c->frame)));
+                        stat_add(STAT_ZEROCOPY_SENT, 1);
+                    } else if (num < 0 && errno == ENOBUFS) { // optmem_max
+                        num = send(sock, buf, rem, 0);
+                    }
+                } else {
+                    num = send(sock, buf, rem, 0);
                 }
-                if (errno != EINTR && errno != EAGAIN) {
-                    for (itr = chunks.begin(); itr != chunks.end(); ++itr) {
-                        chunk_fini(*itr);
+                if (num < 0) {
+                    ctx = context_find(cid);
+                    if (ctx == NULL) { // context has destroyed
+                        break;
+                    }
+                    if (errno != EINTR && errno != EAGAIN) {
+                        for (itr = chunks.begin(); itr != chunks.end(); ++itr) {
+                            chunk_fini(*itr);
+                        }
+                        net_close(ctx->peer.id);
+                        LOG_ERROR("net", "%s send FAILED: %s.",
+                                ctx->peer.info,
+                                strerror(errno));
+                    } else {
+                        push_send(ctx, chunks);
+                        done = false;
                     }
-                    net_close(ctx->peer.id);
-                    LOG_ERROR("net", "%s send FAILED: %s.",
-                            ctx->peer.info,
-                            strerror(errno));
+                    goto stat;
                 } else {
-                    push_send(ctx, chunks);
-                    done = false;
+                    rem -= num;
+                    c->rd_offset += num;
+                    sum += num;
                 }
-                goto stat;
-            } else {
-                rem -= num;
-                c->rd_offset += num;
-                sum += num;
             }
+            chunk_fini(c);
+            itr = chunks.erase(itr);
         }
-        chunk_fini(c);
-        itr = chunks.erase(itr);
-    }
+    } while (ctx != NULL && send_pending(ctx)); // sent within budget
     if (ctx == NULL) {
         return false;
     }
@@ -1553,7 +2486,82 @@ stat:
     mutex_lock(&(ctx->lock));
     ctx->send_data->pending_size -= sum;
     mutex_unlock(&(ctx->lock));
-    return done;
+    return done && ctx->zerocopy_pending.empty();
+}
+
+static void zerocopy_done(context_t *ctx, uint32_t lo, uint32_t hi)
+{
+    zerocopy_queue &q = ctx->zerocopy_pending;
+    zerocopy_queue::iterator itr = q.begin();
+
+    while (itr != q.end()) {
+        if ((uint32_t)(itr->first - lo) <= (uint32_t)(hi - lo)) {
+            frame_fini(itr->second);
+            itr = q.erase(itr);
+        } else {
+            ++itr;
+        }
+    }
+}
+
+///
+/// Release frames completed by kernel, run in writer thread.
+///
+static void zerocopy_reap(context_t *ctx)
+{
+    char control[128];
+    struct msghdr msg;
+
+    while (true) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(ctx->peer.sock, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            break;
+        }
+
+        struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+
+        for (; cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+            if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR)
+                    && !(cm->cmsg_level == SOL_IPV6
+                        && cm->cmsg_type == IPV6_RECVERR)) {
+                continue;
+            }
+
+            struct sock_extended_err *ee =
+                (struct sock_extended_err *)CMSG_DATA(cm);
+
+            if (ee->ee_errno != 0 || ee->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+            if (ee->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                stat_add(STAT_ZEROCOPY_COPIED, ee->ee_data - ee->ee_info + 1);
+            }
+            zerocopy_done(ctx, ee->ee_info, ee->ee_data);
+        }
+    }
+}
+
+///
+/// EPOLLERR caused by zerocopy completion, reaped by writer thread.
+/// @return true if it is NOT an error.
+///
+static bool on_errqueue(const epoll_event &evt)
+{
+    context_t *ctx = static_cast<context_t *>(evt.data.ptr);
+    int err = 0;
+    socklen_t len = sizeof(err);
+
+    if (!ctx->zerocopy || (evt.events & EPOLLHUP)
+            || !(evt.events & EPOLLERR)) {
+        return false;
+    }
+    if (0 != getsockopt(ctx->peer.sock, SOL_SOCKET, SO_ERROR, &err, &len)
+            || err != 0) {
+        return false;
+    }
+    return true;
 }
 
 static void on_error(const epoll_event &evt)
@@ -1581,6 +2589,22 @@ void net_register_raw(const std::string &name)
     s_raw_msgs.insert(name);
 }
 
+void net_priority(const std::string &name, int prio)
+{
+    assert(prio >= NET_PRIO_HIGH && prio < NET_PRIO_SIZE);
+    s_msg_prios[name] = prio;
+}
+
+void net_fragment_set(oid_t peer, bool flag)
+{
+    context_t *ctx = context_find(peer);
+    if (ctx != NULL) {
+        mutex_lock(&(ctx->lock));
+        ctx->fragment = flag;
+        mutex_unlock(&(ctx->lock));
+    }
+}
+
 void net_internal_set(oid_t peer, bool flag)
 {
     context_t *ctx = context_find(peer);
@@ -34,9 +34,21 @@ enum net_stat_flag {
     NET_STAT_ALL        = 0xff,
 };
 
+///
+/// Message priority, sending of lower ones may be delayed by higher ones.
+/// Messages of different priorities may be received out of order.
+///
+enum net_prio {
+    NET_PRIO_HIGH       = 0,
+    NET_PRIO_NORMAL     = 1,
+    NET_PRIO_LOW        = 2,
+    NET_PRIO_SIZE,
+};
+
 typedef void (*encrypt_func)(char* buf, int len);
 struct blob_t;
 struct context_t;
+struct stat_msg_t;
 
 struct recv_message_t {
     std::string name;
@@ -65,6 +77,13 @@ int net_fini(void);
 ///
 void net_encrypt(encrypt_func encry, encrypt_func decry);
 
+///
+/// Send large messages by MSG_ZEROCOPY(Linux 4.14+), shared by peers.
+/// Only affects connections created afterwards, and not enciphered ones.
+/// @param size Minimum size of message, 0 to disable.
+///
+void net_zerocopy(int size);
+
 ///
 /// Start server.
 /// @param name Server name.
@@ -84,25 +103,28 @@ int net_listen(const std::string &name, const std::string &ip, int port);
 int net_listen6(const std::string &name, const std::string &ip, int port);
 
 ///
-/// Start client.
+/// Start client(non-blocking).
+/// `Init.Req` is received once connected, `Fail.Req` on each failed
+/// attempt, and it is retried with jittered exponential backoff until
+/// connected or `net_close`.
 /// @param idx Application index.
 /// @param peer Peer id.
 /// @param name Peer name.
 /// @param ip Peer ip string.
 /// @param port Peer port.
-/// @return (0).
+/// @return (0), or (-1) if the address is invalid.
 ///
 int net_connect(int idx, oid_t peer, const std::string &name,
         const std::string &ip, int port);
 
 ///
-/// Start client supports IPv6.
+/// Start client supports IPv6(non-blocking), see `net_connect`.
 /// @param idx Application index.
 /// @param peer Peer id.
 /// @param name Peer name.
 /// @param ip Peer ip string.
 /// @param port Peer port.
-/// @return (0).
+/// @return (0), or (-1) if the address is invalid.
 ///
 int net_connect6(int idx, oid_t peer, const std::string &name,
         const std::string &ip, int port);
@@ -125,9 +147,23 @@ int net_proc(void);
 ///
 void net_stat(int flag);
 
+///
+/// Get statistics slot of message, created if not exist.
+/// @param name Message name.
+/// @return Slot kept until the end.
+///
+stat_msg_t *net_stat_slot(const std::string &name);
+
 ///
 /// Statistics message info.
 /// @param msg Receive message data.
+/// @param slot Statistics slot of message.
+///
+void net_stat_message(const recv_message_t &msg, stat_msg_t *slot);
+
+///
+/// Statistics message info, slot looked up by name.
+/// @param msg Receive message data.
 ///
 void net_stat_message(const recv_message_t &msg);
 
@@ -232,10 +268,50 @@ void net_send(const obj_map_id &peers, const pb_t &pb);
 
 void net_rawsend(oid_t peer, const std::string &name, const std::string &body);
 
+///
+/// Join peer into group, created on demand.
+/// @param[in] group Group id.
+/// @param[in] peer Peer id.
+///
+void net_group_join(oid_t group, oid_t peer);
+
+///
+/// Leave peer from group, released if empty. Closed peers leave all
+/// groups automatically.
+/// @param[in] group Group id.
+/// @param[in] peer Peer id.
+///
+void net_group_leave(oid_t group, oid_t peer);
+
+///
+/// Broadcast to group, encoded once and shared by members, fanned out by
+/// writer threads.
+/// @param[in] group Group id.
+/// @param[in] pb Message.
+///
+void net_group_send(oid_t group, const pb_t &pb);
+
 void net_cipher_set(oid_t peer, cipher_t *encipher, cipher_t *decipher);
 
 void net_register_raw(const std::string &name);
 
+///
+/// Set priority of message(NET_PRIO_NORMAL by default), ignored by
+/// enciphered peers(kept in order).
+/// @param[in] name Message name.
+/// @param[in] prio Priority(net_prio).
+///
+void net_priority(const std::string &name, int prio);
+
+///
+/// Split large messages sent to peer into fragments, which could be
+/// interleaved by messages of higher priority. The peer MUST be capable
+/// of reassembling fragments.
+/// @param[in] peer Peer id.
+/// @param[in] flag Enable or not.
+///
+void net_fragment_set(oid_t peer, bool flag);
+
 void net_internal_set(oid_t peer, bool flag);
 
 bool net_internal(const context_t &ctx);
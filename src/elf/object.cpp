@@ -6,100 +6,214 @@
 #include <elf/log.h>
 #include <elf/object.h>
 #include <elf/memory.h>
+#include <cxxabi.h>
+#include <string.h>
 
 namespace elf {
-obj_map_id Object::s_objs;
+OIDMap<Object *> Object::s_objs;
 Object::pbref_map_id Object::s_pbs;
+int Object::s_snaps;
+PoolBase *PoolBase::s_pools;
+
+PoolBase::PoolBase(const char *name, size_t size) :
+    m_name(name),
+    m_size(size),
+    m_used(0),
+    m_capacity(0),
+    m_next(s_pools)
+{
+    s_pools = this;
+}
+
+void PoolBase::Stat(void)
+{
+    for (const PoolBase *p = s_pools; p != NULL; p = p->m_next) {
+        int status = 0;
+        char *name = abi::__cxa_demangle(p->m_name, NULL, NULL, &status);
+
+        LOG_INFO("stat", "pool %s: %d/%d, %d KB",
+                (name != NULL) ? name : p->m_name,
+                p->m_used,
+                p->m_capacity,
+                (int)(p->m_size * p->m_capacity / 1024));
+        free(name); // by __cxa_demangle
+    }
+}
 
 Object::Object() :
     m_id(OID_NIL),
     m_sid(0),
     m_pb(NULL)
 {
+    memset(m_shadows, 0, sizeof(m_shadows));
 }
 
 Object::Object(oid_t id)
-    : m_id(id)
+    : m_id(id),
+    m_sid(0),
+    m_pb(NULL)
 {
+    memset(m_shadows, 0, sizeof(m_shadows));
 }
 
 Object::~Object(void)
 {
+    for (int i = 0; i < DIRTY_MAX; ++i) {
+        E_DELETE(m_shadows[i]);
+    }
     DelPB(m_id);
-    s_objs.erase(m_id);
+    if (s_objs.Find(m_id) == this) {
+        s_objs.Erase(m_id);
+    }
 }
 
 void Object::OnInit(void)
 {
-    obj_map_id::const_iterator itr = s_objs.find(m_id);
-
-    if (itr != s_objs.end()) {
-        Object *obj = itr->second;
+    Object *obj = s_objs.Find(m_id);
 
+    if (obj != NULL) {
         LOG_ERROR("sys", "<%lld>(%s) - (%s)",
                 m_id,
                 obj->GetName().c_str(),
                 m_name.c_str());
     }
-    s_objs[m_id] = this;
+    s_objs.Insert(m_id, this);
     if (m_pb != NULL) {
         PBRef *pr = E_NEW PBRef;
 
         pr->pb = m_pb;
+        pr->release = NULL;
+        pr->snap = NULL;
+        pr->version = 0;
         pr->ref = 1;
-        s_pbs[m_id] = pr;
+        s_pbs.Insert(m_id, pr);
     }
 }
 
+int Object::GetDirty(dirty_type type, pb_mask *mask)
+{
+    assert(m_pb && mask && type >= 0 && type < DIRTY_MAX);
+
+    if (m_shadows[type] == NULL) {
+        m_shadows[type] = m_pb->New();
+    }
+    return pb_diff(*m_pb, *(m_shadows[type]), mask);
+}
+
+void Object::ClearDirty(dirty_type type, const pb_mask &mask)
+{
+    assert(m_pb && type >= 0 && type < DIRTY_MAX);
+
+    if (m_shadows[type] == NULL) {
+        m_shadows[type] = m_pb->New();
+    }
+    pb_copy(m_shadows[type], *m_pb, mask);
+}
+
+int Object::Delta(std::string *out)
+{
+    pb_mask mask;
+    int num = GetDirty(DIRTY_NET, &mask);
+
+    if (num > 0) {
+        pb_delta(*m_pb, mask, out);
+        ClearDirty(DIRTY_NET, mask);
+    }
+    return num;
+}
+
+int Object::Columns(std::string *out)
+{
+    pb_mask mask;
+    int num = 0;
+
+    if (GetDirty(DIRTY_DB, &mask) > 0) {
+        num = pb_columns(*m_pb, mask, out);
+        ClearDirty(DIRTY_DB, mask);
+    }
+    return num;
+}
+
 void Object::Stat(void)
 {
     LOG_INFO("stat", "protobufs: %d, objects: %d",
-            s_pbs.size(),
-            s_objs.size());
+            s_pbs.Size(),
+            s_objs.Size());
+    PoolBase::Stat();
 }
 
 void Object::Release(void)
 {
-    obj_map_id::iterator itr = s_objs.begin();
-    while (itr != s_objs.end()) {
-        Object *obj = itr->second;
+    // objects erase themselves when deleted
+    while (s_objs.Size() > 0) {
+        Object *obj = s_objs.ValueAt(s_objs.Size() - 1);
 
-        s_pbs.erase(obj->m_id);
+        s_objs.Erase(obj->m_id);
         S_DELETE(obj);
     }
+    for (int i = 0; i < s_pbs.Size(); ++i) {
+        PBRef *ref = s_pbs.ValueAt(i);
 
-    pbref_map_id::iterator itr_p = s_pbs.begin();
-    while (itr_p != s_pbs.end()) {
-        PBRef *ref = itr_p->second;
-
-        S_DELETE(ref->pb);
+        ReleasePB(ref);
         S_DELETE(ref);
     }
+    s_pbs.Clear();
 }
 
 void Object::DelPB(oid_t id)
 {
-    pbref_map_id::const_iterator itr = s_pbs.find(id);
-
-    if (itr != s_pbs.end()) {
-        PBRef *pr = itr->second;
+    PBRef *pr = s_pbs.Find(id);
 
+    if (pr != NULL) {
         --(pr->ref);
         if (pr->ref <= 0) {
-            E_DELETE(pr->pb);
+            ReleasePB(pr);
             E_DELETE(pr);
-            s_pbs.erase(id);
+            s_pbs.Erase(id);
         }
     }
 }
 
-Object::PBRef *Object::FindRef(oid_t id) {
-    pbref_map_id::const_iterator itr =s_pbs.find(id);
+void Object::ReleasePB(PBRef *pr)
+{
+    DropSnap(pr);
+    if (pr->release != NULL) {
+        pr->release(pr->pb);
+    } else {
+        E_DELETE(pr->pb);
+    }
+    pr->pb = NULL;
+}
 
-    if (itr != s_pbs.end()) {
-        return itr->second;
+PBSnap *Object::Snapshot(oid_t id)
+{
+    PBRef *pr = s_pbs.Find(id);
+
+    if (pr == NULL) {
+        return NULL;
+    }
+    if (pr->snap != NULL && pr->snap->m_version != pr->version) {
+        DropSnap(pr);
+    }
+    if (pr->snap == NULL) {
+        pr->snap = E_NEW PBSnap(*(pr->pb), pr->version);
+        ++s_snaps;
+    }
+    pr->snap->Retain();
+    return pr->snap;
+}
+
+void Object::Touch(oid_t id)
+{
+    PBRef *pr = s_pbs.Find(id);
+
+    if (pr != NULL) {
+        ++(pr->version);
     }
-    return NULL;
+}
+
+Object::PBRef *Object::FindRef(oid_t id) {
+    return s_pbs.Find(id);
 }
 } // namespace elf
 
@@ -19,14 +19,420 @@
 #include <elf/memory.h>
 #include <elf/oid.h>
 #include <elf/pb.h>
+#include <stdlib.h>
 #include <map>
 #include <string>
+#include <typeinfo>
 #include <vector>
 
 namespace elf {
 class Object;
 class PBRef;
 
+///
+/// Slab pool base, registered for statistics.
+///
+class PoolBase {
+public:
+    ///
+    /// Output statistics info of all pools.
+    ///
+    static void Stat(void);
+
+protected:
+    PoolBase(const char *name, size_t size);
+
+    /// mangled type name(typeid), demangled in stats
+    const char *m_name;
+
+    /// chunk size
+    size_t m_size;
+
+    /// chunks in use
+    int m_used;
+
+    /// chunks allocated
+    int m_capacity;
+
+    /// next pool
+    PoolBase *m_next;
+
+    /// all pools
+    static PoolBase *s_pools;
+};
+
+///
+/// Per-type slab pool, chunks are never returned to the system but reused
+/// by the same type. Single thread only, as the object map.
+///
+template<class Type>
+class ObjectPool : public PoolBase {
+public:
+    static ObjectPool &Instance(void) {
+        static ObjectPool pool;
+
+        return pool;
+    }
+
+    ///
+    /// Get a chunk for sizeof(Type), constructed by placement new.
+    ///
+    void *Alloc(void) {
+        if (m_free == NULL) {
+            Grow();
+        }
+
+        chunk_t *c = m_free;
+
+        m_free = c->next;
+        ++m_used;
+        return c;
+    }
+
+    ///
+    /// Put back a chunk, destructed already.
+    ///
+    void Free(void *p) {
+        chunk_t *c = static_cast<chunk_t *>(p);
+
+        c->next = m_free;
+        m_free = c;
+        --m_used;
+    }
+
+    ///
+    /// Create a copy in the pool.
+    ///
+    Type *Clone(const Type &src) {
+        return new (Alloc()) Type(src);
+    }
+
+    ///
+    /// Destruct and put back.
+    ///
+    static void Release(pb_t *p) {
+        Type *t = static_cast<Type *>(p);
+
+        t->~Type();
+        Instance().Free(t);
+    }
+
+    ///
+    /// Get number of chunks in use.
+    ///
+    inline int Used(void) const { return m_used; }
+
+    ///
+    /// Get number of chunks allocated.
+    ///
+    inline int Capacity(void) const { return m_capacity; }
+
+private:
+    // aligned as Type, slabs are aligned the same
+    union chunk_t {
+        chunk_t *next;
+        char data[sizeof(Type)];
+    } __attribute__((aligned(__alignof__(Type))));
+
+    enum {
+        SLAB_SIZE = 65536,
+        SLAB_CHUNKS = (SLAB_SIZE / sizeof(chunk_t) > 16)
+            ? SLAB_SIZE / sizeof(chunk_t) : 16,
+    };
+
+    ObjectPool(void) :
+        PoolBase(typeid(Type).name(), sizeof(chunk_t)),
+        m_free(NULL)
+    {
+    }
+
+    void Grow(void) {
+        void *buf = NULL;
+
+        if (posix_memalign(&buf, __alignof__(chunk_t),
+                    sizeof(chunk_t) * SLAB_CHUNKS) != 0) {
+            abort();
+        }
+
+        chunk_t *slab = (chunk_t *)buf;
+
+        for (int i = SLAB_CHUNKS - 1; i >= 0; --i) {
+            slab[i].next = m_free;
+            m_free = slab + i;
+        }
+        m_slabs.push_back(slab);
+        m_capacity += SLAB_CHUNKS;
+    }
+
+    chunk_t *m_free;
+    std::vector<chunk_t *> m_slabs;
+};
+
+///
+/// Allocate objects of the class from ObjectPool<Type> by E_NEW/E_DELETE,
+/// derived classes with different sizes fall back to the heap.
+///
+#define OBJECT_POOL(Type)                                                   \
+    public:                                                                 \
+    static void *operator new(size_t size) {                                \
+        if (size != sizeof(Type)) {                                         \
+            return ::operator new(size);                                    \
+        }                                                                   \
+        return elf::ObjectPool<Type>::Instance().Alloc();                   \
+    }                                                                       \
+    static void operator delete(void *p, size_t size) {                     \
+        if (p == NULL) {                                                    \
+            return;                                                         \
+        }                                                                   \
+        if (size != sizeof(Type)) {                                         \
+            ::operator delete(p);                                           \
+            return;                                                         \
+        }                                                                   \
+        elf::ObjectPool<Type>::Instance().Free(p);                          \
+    }
+
+///
+/// Open addressing hash map of oid_t keys, with linear probing and
+/// backward shift deletion. Keys and values are kept in dense arrays for
+/// iteration, indexed by [0, Size()).
+///
+template<class Type>
+class OIDMap {
+public:
+    OIDMap(void) :
+        m_slots(NULL),
+        m_mask(0)
+    {
+    }
+
+    ~OIDMap(void) {
+        E_FREE(m_slots);
+    }
+
+    ///
+    /// Find value by id.
+    /// @param id Key.
+    /// @return Value if found, or Type().
+    ///
+    inline Type Find(oid_t id) const {
+        if (m_slots == NULL) {
+            return Type();
+        }
+
+        int idx = m_slots[Probe(id)].idx;
+
+        return (idx >= 0) ? m_vals[idx] : Type();
+    }
+
+    ///
+    /// Insert or replace value.
+    /// @param id Key.
+    /// @param val Value.
+    ///
+    void Insert(oid_t id, Type val) {
+        if ((m_keys.size() + 1) * 4 > (m_mask + 1) * 3) { // load factor 0.75
+            Rehash(m_slots == NULL ? 64 : (m_mask + 1) * 2);
+        }
+
+        slot_t &s = m_slots[Probe(id)];
+
+        if (s.idx >= 0) {
+            m_vals[s.idx] = val;
+            return;
+        }
+        s.key = id;
+        s.idx = m_keys.size();
+        m_keys.push_back(id);
+        m_vals.push_back(val);
+    }
+
+    ///
+    /// Erase value by id, the last value is moved into its position.
+    /// @param id Key.
+    /// @return false if not found.
+    ///
+    bool Erase(oid_t id) {
+        if (m_slots == NULL) {
+            return false;
+        }
+
+        size_t pos = Probe(id);
+        int idx = m_slots[pos].idx;
+
+        if (idx < 0) {
+            return false;
+        }
+
+        int last = m_keys.size() - 1;
+
+        if (idx != last) { // fill the hole of dense arrays
+            m_keys[idx] = m_keys[last];
+            m_vals[idx] = m_vals[last];
+            m_slots[Probe(m_keys[idx])].idx = idx;
+        }
+        m_keys.pop_back();
+        m_vals.pop_back();
+
+        size_t next = pos;
+
+        for (;;) {
+            m_slots[pos].idx = -1;
+            for (;;) {
+                next = (next + 1) & m_mask;
+                if (m_slots[next].idx < 0) {
+                    return true;
+                }
+
+                size_t home = Hash(m_slots[next].key) & m_mask;
+
+                // move back if home is not in (pos, next]
+                if ((next > pos && (home <= pos || home > next))
+                        || (next < pos && (home <= pos && home > next))) {
+                    break;
+                }
+            }
+            m_slots[pos] = m_slots[next];
+            pos = next;
+        }
+    }
+
+    inline int Size(void) const { return m_keys.size(); }
+    inline oid_t KeyAt(int i) const { return m_keys[i]; }
+    inline Type ValueAt(int i) const { return m_vals[i]; }
+
+    ///
+    /// Get number of slots, grown by twice at load factor 0.75.
+    /// @return Number of slots, 0 if never inserted.
+    ///
+    inline int Capacity(void) const {
+        return (m_slots == NULL) ? 0 : (int)(m_mask + 1);
+    }
+
+    ///
+    /// Hash of key, probing starts from slot Hash(id) & (Capacity() - 1).
+    ///
+    static inline size_t Hash(oid_t id) {
+        uint64_t h = (uint64_t)id * 0x9e3779b97f4a7c15ULL;
+
+        return (size_t)(h ^ (h >> 29));
+    }
+
+    void Clear(void) {
+        m_keys.clear();
+        m_vals.clear();
+        for (size_t i = 0; m_slots != NULL && i <= m_mask; ++i) {
+            m_slots[i].idx = -1;
+        }
+    }
+
+private:
+    struct slot_t {
+        oid_t key;
+        int idx; // index of dense arrays, -1 if empty
+    };
+
+    ///
+    /// Find slot of given key, or the empty slot to insert.
+    ///
+    inline size_t Probe(oid_t id) const {
+        size_t pos = Hash(id) & m_mask;
+
+        while (m_slots[pos].idx >= 0 && m_slots[pos].key != id) {
+            pos = (pos + 1) & m_mask;
+        }
+        return pos;
+    }
+
+    void Rehash(size_t cap) {
+        E_FREE(m_slots);
+        m_slots = (slot_t *)E_ALLOC(sizeof(slot_t) * cap);
+        m_mask = cap - 1;
+        for (size_t i = 0; i < cap; ++i) {
+            m_slots[i].idx = -1;
+        }
+        for (size_t i = 0; i < m_keys.size(); ++i) {
+            slot_t &s = m_slots[Probe(m_keys[i])];
+
+            s.key = m_keys[i];
+            s.idx = i;
+        }
+    }
+
+    slot_t *m_slots;
+    size_t m_mask; // capacity - 1
+    std::vector<oid_t> m_keys;
+    std::vector<Type> m_vals;
+
+    OIDMap(const OIDMap &);
+    OIDMap &operator=(const OIDMap &);
+};
+
+///
+/// Immutable reference-counted protobuf snapshot. Snapshots are taken on
+/// the main thread, held and released on any thread.
+///
+class PBSnap {
+public:
+    ///
+    /// Get protobuf data.
+    /// @return Protobuf data.
+    ///
+    template<class Type>
+    inline const Type &Get(void) const {
+        return *(static_cast<const Type *>(m_pb));
+    }
+
+    ///
+    /// Get protobuf data.
+    /// @return Protobuf data.
+    ///
+    inline const pb_t &Get(void) const { return *m_pb; }
+
+    ///
+    /// Add a reference.
+    ///
+    inline void Retain(void) {
+        __sync_add_and_fetch(&m_ref, 1);
+    }
+
+    ///
+    /// Drop a reference, free the snapshot by the last one.
+    ///
+    inline void Release(void) {
+        if (__sync_sub_and_fetch(&m_ref, 1) == 0) {
+            E_DELETE(m_pb);
+            E_DELETE(this);
+        }
+    }
+
+private:
+    friend class Object;
+
+    /// copy allocated from heap, pools are main thread only
+    PBSnap(const pb_t &pb, unsigned int version) :
+        m_pb(pb.New()),
+        m_version(version),
+        m_ref(1)
+    {
+        m_pb->CopyFrom(pb);
+    }
+
+    ~PBSnap(void) {}
+
+    pb_t *m_pb;
+    unsigned int m_version; // of PBRef when taken
+    volatile int m_ref;
+};
+
+///
+/// Consumers of dirty fields, each has its own shadow.
+///
+enum dirty_type {
+    DIRTY_NET,      // network sync
+    DIRTY_DB,       // persistence
+    DIRTY_MAX,
+};
+
 typedef std::list<Object *> obj_list;
 typedef std::map<oid_t, Object *> obj_map_id;
 typedef std::map<int, Object *> obj_map_int;
@@ -54,6 +460,9 @@ public:
     template<class Type>
     inline Type *GetPB(void) {
         assert(m_pb);
+        if (s_snaps > 0) {
+            Touch(m_id);
+        }
         return static_cast<Type *>(m_pb);
     }
 
@@ -72,6 +481,36 @@ public:
     ///
     void OnInit(void);
 
+    ///
+    /// Get fields changed since last `ClearDirty` of the consumer, compared
+    /// with its shadow copy of pb data, all set fields are dirty at first.
+    /// @param[in] type Consumer.
+    /// @param[out] mask Changed fields, merged into.
+    /// @return Number of changed fields.
+    ///
+    int GetDirty(dirty_type type, pb_mask *mask);
+
+    ///
+    /// Mark fields as synchronized for the consumer.
+    /// @param[in] type Consumer.
+    /// @param[in] mask Synchronized fields.
+    ///
+    void ClearDirty(dirty_type type, const pb_mask &mask);
+
+    ///
+    /// Encode changed fields for network sync, and mark them synchronized.
+    /// @param[out] out Delta data(@see pb_delta), appended.
+    /// @return Number of changed fields.
+    ///
+    int Delta(std::string *out);
+
+    ///
+    /// Format changed columns for persistence, and mark them synchronized.
+    /// @param[out] out SQL assignments(@see pb_columns), appended.
+    /// @return Number of columns.
+    ///
+    int Columns(std::string *out);
+
     ///
     /// Output statistics info.
     ///
@@ -95,11 +534,15 @@ public:
 
             if (pr == NULL) {
                 pr = E_NEW PBRef;
-                pr->pb = dst = E_NEW Type(pb);
+                pr->pb = dst = ObjectPool<Type>::Instance().Clone(pb);
+                pr->release = ObjectPool<Type>::Release;
+                pr->snap = NULL;
+                pr->version = 0;
                 pr->ref = ref;
-                s_pbs[id] = pr;
+                s_pbs.Insert(id, pr);
             } else {
                 dst = static_cast<Type *>(pr->pb);
+                ++(pr->version);
                 if (dst != &pb) {
                     dst->CopyFrom(pb);
                 }
@@ -121,12 +564,12 @@ public:
         static bool ClonePB(pb_t *pb, oid_t id) {
             assert(pb);
 
-            Type *src = FindPB<Type>(id);
+            PBRef *pr = s_pbs.Find(id);
 
-            if (src == NULL) {
+            if (pr == NULL) {
                 return false;
             }
-            pb->CopyFrom(*src);
+            pb->CopyFrom(*(pr->pb));
             return true;
         }
 
@@ -140,13 +583,7 @@ public:
             if (id == elf::OID_NIL) {
                 return NULL;
             }
-
-            obj_map_id::const_iterator itr =s_objs.find(id);
-
-            if (itr != s_objs.end()) {
-                return static_cast<Type *>(itr->second);
-            }
-            return NULL;
+            return static_cast<Type *>(s_objs.Find(id));
         }
 
     ///
@@ -159,13 +596,7 @@ public:
             if (id == elf::OID_NIL) {
                 return NULL;
             }
-
-            obj_map_id::const_iterator itr =s_objs.find(id);
-
-            if (itr != s_objs.end()) {
-                return dynamic_cast<Type *>(itr->second);
-            }
-            return NULL;
+            return dynamic_cast<Type *>(s_objs.Find(id));
         }
 
     ///
@@ -179,34 +610,73 @@ public:
                 return NULL;
             }
 
-            pbref_map_id::const_iterator itr =s_pbs.find(id);
+            PBRef *pr = s_pbs.Find(id);
 
-            if (itr != s_pbs.end()) {
-                return static_cast<Type *>(itr->second->pb);
+            if (pr == NULL) {
+                return NULL;
             }
-            return NULL;
+            ++(pr->version);
+            return static_cast<Type *>(pr->pb);
         }
 
+    ///
+    /// Get snapshot of protobuf object, shared by all readers until the
+    /// next mutable access, so one copy serves both saving and
+    /// broadcasting. `FindPB`/`GetPB`/`AddPB` bump the version of the
+    /// protobuf object, writes through pointers kept from earlier calls
+    /// need `Touch`.
+    /// @param id protobuf object id.
+    /// @return Snapshot to be released by `PBSnap::Release`, or NULL.
+    ///
+    static PBSnap *Snapshot(oid_t id);
+
+    ///
+    /// Bump version of protobuf object, the next `Snapshot` copies it.
+    /// @param id protobuf object id.
+    ///
+    static void Touch(oid_t id);
+
     ///
     /// Get size of object map.
     /// @return Size of object map.
     ///
-    static int Size(void) { return s_objs.size(); }
+    static int Size(void) { return s_objs.Size(); }
 
     ///
     /// Get size of protobuf map.
     /// @return Size of object map.
     ///
-    static int SizePB(void) { return s_pbs.size(); }
+    static int SizePB(void) { return s_pbs.Size(); }
 
     virtual ~Object(void);
 
 protected:
     struct PBRef {
+        OBJECT_POOL(PBRef)
+
         pb_t *pb;
+        void (*release)(pb_t *); // put back into pool, NULL if E_NEW
+        PBSnap *snap; // shared snapshot, stale if versions differ
+        unsigned int version; // bumped by mutable access
         int ref;
     };
 
+    ///
+    /// Drop shared snapshot.
+    ///
+    static inline void DropSnap(PBRef *pr) {
+        if (pr->snap != NULL) {
+            pr->snap->Release();
+            pr->snap = NULL;
+            --s_snaps;
+        }
+    }
+
+    ///
+    /// Release protobuf object of PBRef.
+    ///
+    static void ReleasePB(PBRef *pr);
+
     ///
     /// Find PBRef by id.
     /// @param id Object id.
@@ -214,7 +684,7 @@ protected:
     ///
     static PBRef *FindRef(oid_t id);
 
-    typedef std::map<oid_t, PBRef *> pbref_map_id;
+    typedef OIDMap<PBRef *> pbref_map_id;
 
     Object();
     Object(oid_t id);
@@ -231,12 +701,18 @@ protected:
     /// pb data
     pb_t *m_pb;
 
+    /// pb data at last sync of each consumer
+    pb_t *m_shadows[DIRTY_MAX];
+
     /// global Object map
-    static obj_map_id s_objs;
+    static OIDMap<Object *> s_objs;
 
     /// global protobuf map
     static pbref_map_id s_pbs;
 
+    /// number of shared snapshots
+    static int s_snaps;
+
     /// global protobuf map
     static pb_map_int s_pbs_i;
 };
@@ -15,7 +15,7 @@ const oid_t MAX_TIME = 10000000000000ll;
 oid_t oid_gen(void)
 {
     static oid_t id = 0;
-    oid_t time = (oid_t)time_ms();
+    oid_t time = (oid_t)time_frame_ms();
 
     assert(MAGIC_INDEX < MAX_INDEX && time < MAX_TIME);
 
@@ -4,8 +4,12 @@
  */
 
 #include <elf/pb.h>
+#include <elf/db.h>
 #include <elf/log.h>
 #include <elf/memory.h>
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/io/zero_copy_stream_impl_lite.h>
+#include <stdio.h>
 #include <map>
 #include <string>
 
@@ -148,5 +152,271 @@ void pb_set_field(pb_t *pb, const FieldDescriptor *fd,
             assert(0);
     }
 }
+
+static bool value_equal(const pb_t &a, const pb_t &b,
+        const FieldDescriptor *fd, int i)
+{
+    const Reflection *ra = a.GetReflection();
+    const Reflection *rb = b.GetReflection();
+
+#define VALUE_EQUAL(GET)                                                    \
+    (i < 0 ? ra->Get##GET(a, fd) == rb->Get##GET(b, fd)                     \
+     : ra->GetRepeated##GET(a, fd, i) == rb->GetRepeated##GET(b, fd, i))
+
+    switch (fd->cpp_type()) {
+        case FieldDescriptor::CPPTYPE_INT32:
+            return VALUE_EQUAL(Int32);
+        case FieldDescriptor::CPPTYPE_INT64:
+            return VALUE_EQUAL(Int64);
+        case FieldDescriptor::CPPTYPE_UINT32:
+            return VALUE_EQUAL(UInt32);
+        case FieldDescriptor::CPPTYPE_UINT64:
+            return VALUE_EQUAL(UInt64);
+        case FieldDescriptor::CPPTYPE_FLOAT:
+            return VALUE_EQUAL(Float);
+        case FieldDescriptor::CPPTYPE_DOUBLE:
+            return VALUE_EQUAL(Double);
+        case FieldDescriptor::CPPTYPE_BOOL:
+            return VALUE_EQUAL(Bool);
+        case FieldDescriptor::CPPTYPE_ENUM:
+            return VALUE_EQUAL(Enum);
+        case FieldDescriptor::CPPTYPE_STRING:
+            return VALUE_EQUAL(String);
+        case FieldDescriptor::CPPTYPE_MESSAGE:
+            return (i < 0
+                    ? ra->GetMessage(a, fd).SerializePartialAsString()
+                    == rb->GetMessage(b, fd).SerializePartialAsString()
+                    : ra->GetRepeatedMessage(a, fd, i).SerializePartialAsString()
+                    == rb->GetRepeatedMessage(b, fd, i).SerializePartialAsString());
+    }
+#undef VALUE_EQUAL
+    return false;
+}
+
+static bool field_equal(const pb_t &a, const pb_t &b,
+        const FieldDescriptor *fd)
+{
+    const Reflection *ra = a.GetReflection();
+    const Reflection *rb = b.GetReflection();
+
+    if (fd->is_repeated()) {
+        int size = ra->FieldSize(a, fd);
+
+        if (size != rb->FieldSize(b, fd)) {
+            return false;
+        }
+        for (int i = 0; i < size; ++i) {
+            if (!value_equal(a, b, fd, i)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    if (ra->HasField(a, fd) != rb->HasField(b, fd)) {
+        return false;
+    }
+    return value_equal(a, b, fd, -1);
+}
+
+static void field_copy(pb_t *dst, const pb_t &src,
+        const FieldDescriptor *fd)
+{
+    const Reflection *rd = dst->GetReflection();
+    const Reflection *rs = src.GetReflection();
+
+    rd->ClearField(dst, fd);
+    if (fd->is_repeated()) {
+        int size = rs->FieldSize(src, fd);
+
+#define REPEATED_COPY(TYPE)                                                 \
+        for (int i = 0; i < size; ++i) {                                    \
+            rd->Add##TYPE(dst, fd, rs->GetRepeated##TYPE(src, fd, i));      \
+        }                                                                   \
+        break
+
+        switch (fd->cpp_type()) {
+            case FieldDescriptor::CPPTYPE_INT32: REPEATED_COPY(Int32);
+            case FieldDescriptor::CPPTYPE_INT64: REPEATED_COPY(Int64);
+            case FieldDescriptor::CPPTYPE_UINT32: REPEATED_COPY(UInt32);
+            case FieldDescriptor::CPPTYPE_UINT64: REPEATED_COPY(UInt64);
+            case FieldDescriptor::CPPTYPE_FLOAT: REPEATED_COPY(Float);
+            case FieldDescriptor::CPPTYPE_DOUBLE: REPEATED_COPY(Double);
+            case FieldDescriptor::CPPTYPE_BOOL: REPEATED_COPY(Bool);
+            case FieldDescriptor::CPPTYPE_ENUM: REPEATED_COPY(Enum);
+            case FieldDescriptor::CPPTYPE_STRING: REPEATED_COPY(String);
+            case FieldDescriptor::CPPTYPE_MESSAGE:
+                for (int i = 0; i < size; ++i) {
+                    rd->AddMessage(dst, fd)->CopyFrom(
+                            rs->GetRepeatedMessage(src, fd, i));
+                }
+                break;
+        }
+#undef REPEATED_COPY
+        return;
+    }
+    if (!rs->HasField(src, fd)) {
+        return;
+    }
+
+#define SINGULAR_COPY(TYPE)                                                 \
+    rd->Set##TYPE(dst, fd, rs->Get##TYPE(src, fd));                         \
+    break
+
+    switch (fd->cpp_type()) {
+        case FieldDescriptor::CPPTYPE_INT32: SINGULAR_COPY(Int32);
+        case FieldDescriptor::CPPTYPE_INT64: SINGULAR_COPY(Int64);
+        case FieldDescriptor::CPPTYPE_UINT32: SINGULAR_COPY(UInt32);
+        case FieldDescriptor::CPPTYPE_UINT64: SINGULAR_COPY(UInt64);
+        case FieldDescriptor::CPPTYPE_FLOAT: SINGULAR_COPY(Float);
+        case FieldDescriptor::CPPTYPE_DOUBLE: SINGULAR_COPY(Double);
+        case FieldDescriptor::CPPTYPE_BOOL: SINGULAR_COPY(Bool);
+        case FieldDescriptor::CPPTYPE_ENUM: SINGULAR_COPY(Enum);
+        case FieldDescriptor::CPPTYPE_STRING: SINGULAR_COPY(String);
+        case FieldDescriptor::CPPTYPE_MESSAGE:
+            rd->MutableMessage(dst, fd)->CopyFrom(rs->GetMessage(src, fd));
+            break;
+    }
+#undef SINGULAR_COPY
+}
+
+int pb_diff(const pb_t &pb, const pb_t &shadow, pb_mask *mask)
+{
+    assert(mask);
+    assert(pb.GetDescriptor() == shadow.GetDescriptor());
+
+    const Descriptor *des = pb.GetDescriptor();
+    int num = 0;
+
+    for (int i = 0; i < des->field_count(); ++i) {
+        if (!field_equal(pb, shadow, des->field(i))) {
+            pb_mask_set(mask, i);
+            ++num;
+        }
+    }
+    return num;
+}
+
+void pb_copy(pb_t *dst, const pb_t &src, const pb_mask &mask)
+{
+    assert(dst && dst->GetDescriptor() == src.GetDescriptor());
+
+    const Descriptor *des = src.GetDescriptor();
+
+    for (int i = 0; i < des->field_count(); ++i) {
+        if (pb_mask_test(mask, i)) {
+            field_copy(dst, src, des->field(i));
+        }
+    }
+}
+
+void pb_delta(const pb_t &pb, const pb_mask &mask, std::string *out)
+{
+    assert(out);
+
+    pb_t *part = pb.New();
+
+    pb_copy(part, pb, mask);
+    {
+        io::StringOutputStream os(out);
+        io::CodedOutputStream cos(&os);
+
+        cos.WriteVarint32(mask.size());
+        for (size_t i = 0; i < mask.size(); ++i) {
+            cos.WriteVarint32(mask[i]);
+        }
+    }
+    part->AppendPartialToString(out);
+    E_DELETE(part);
+}
+
+bool pb_apply(pb_t *pb, const char *data, int len)
+{
+    assert(pb && data);
+
+    io::CodedInputStream cis((const uint8 *)data, len);
+    pb_mask mask;
+    uint32 size = 0;
+
+    if (!cis.ReadVarint32(&size) || size > (uint32)len) {
+        return false;
+    }
+    mask.resize(size);
+    for (uint32 i = 0; i < size; ++i) {
+        if (!cis.ReadVarint32(&mask[i])) {
+            return false;
+        }
+    }
+
+    // pb untouched if the delta is broken
+    pb_t *part = pb->New();
+    bool res = part->MergePartialFromCodedStream(&cis);
+
+    if (res) {
+        pb_copy(pb, *part, mask);
+    }
+    E_DELETE(part);
+    return res;
+}
+
+int pb_columns(const pb_t &pb, const pb_mask &mask, std::string *out)
+{
+    assert(out);
+
+    const Descriptor *des = pb.GetDescriptor();
+    const Reflection *ref = pb.GetReflection();
+    int num = 0;
+
+    for (int i = 0; i < des->field_count(); ++i) {
+        const FieldDescriptor *fd = des->field(i);
+        char buf[32];
+
+        if (!pb_mask_test(mask, i) || fd->is_repeated()
+                || fd->cpp_type() == FieldDescriptor::CPPTYPE_MESSAGE) {
+            continue;
+        }
+        if (num > 0) {
+            out->push_back(',');
+        }
+        out->append("`").append(fd->name()).append("`=");
+        buf[0] = '\0';
+        switch (fd->cpp_type()) {
+            case FieldDescriptor::CPPTYPE_INT32:
+                snprintf(buf, sizeof(buf), "%d", ref->GetInt32(pb, fd));
+                break;
+            case FieldDescriptor::CPPTYPE_INT64:
+                snprintf(buf, sizeof(buf), "%lld",
+                        (long long)ref->GetInt64(pb, fd));
+                break;
+            case FieldDescriptor::CPPTYPE_UINT32:
+                snprintf(buf, sizeof(buf), "%u", ref->GetUInt32(pb, fd));
+                break;
+            case FieldDescriptor::CPPTYPE_UINT64:
+                snprintf(buf, sizeof(buf), "%llu",
+                        (unsigned long long)ref->GetUInt64(pb, fd));
+                break;
+            case FieldDescriptor::CPPTYPE_FLOAT:
+                snprintf(buf, sizeof(buf), "%.9g", ref->GetFloat(pb, fd));
+                break;
+            case FieldDescriptor::CPPTYPE_DOUBLE:
+                snprintf(buf, sizeof(buf), "%.17g", ref->GetDouble(pb, fd));
+                break;
+            case FieldDescriptor::CPPTYPE_BOOL:
+                snprintf(buf, sizeof(buf), "%d", ref->GetBool(pb, fd) ? 1 : 0);
+                break;
+            case FieldDescriptor::CPPTYPE_ENUM:
+                snprintf(buf, sizeof(buf), "%d",
+                        ref->GetEnum(pb, fd)->number());
+                break;
+            case FieldDescriptor::CPPTYPE_STRING:
+                db_escape(ref->GetString(pb, fd), out);
+                break;
+            default:
+                break;
+        }
+        out->append(buf);
+        ++num;
+    }
+    return num;
+}
 } // namespace elf
 
@@ -22,6 +22,7 @@
 #include <google/protobuf/message.h>
 #include <map>
 #include <string>
+#include <vector>
 
 namespace elf {
 typedef ::google::protobuf::Message pb_t;
@@ -35,6 +36,9 @@ typedef std::pair <pb_mmap_int::iterator, pb_mmap_int::iterator> pb_mmap_iint;
 typedef std::map<std::string, pb_t *> pb_map_str;
 typedef std::map<int, pb_map_id * > pb_mmap_id;
 
+// field mask, bit i for `Descriptor::field(i)`
+typedef std::vector<uint32_t> pb_mask;
+
 typedef pb_t *(*pb_new)(void);
 
 void message_unregist_all(void);
@@ -102,6 +106,76 @@ void pb_set_field(pb_t *pb, const ::google::protobuf::FieldDescriptor *fd,
 ///
 void pb_set_field(pb_t *pb, const ::google::protobuf::FieldDescriptor *fd,
         const char *val, int len);
+
+///
+/// Set bit of field in mask.
+/// @param[out] mask Field mask.
+/// @param[in] idx Field index in descriptor.
+///
+inline void pb_mask_set(pb_mask *mask, int idx)
+{
+    if ((int)mask->size() <= (idx >> 5)) {
+        mask->resize((idx >> 5) + 1, 0);
+    }
+    (*mask)[idx >> 5] |= 1u << (idx & 31);
+}
+
+///
+/// Test bit of field in mask.
+/// @param[in] mask Field mask.
+/// @param[in] idx Field index in descriptor.
+/// @return true if set.
+///
+inline bool pb_mask_test(const pb_mask &mask, int idx)
+{
+    return (int)mask.size() > (idx >> 5)
+        && (mask[idx >> 5] & (1u << (idx & 31)));
+}
+
+///
+/// Compare protobuf with its shadow field by field.
+/// @param[in] pb Protobuf object.
+/// @param[in] shadow Last synchronized copy with same type.
+/// @param[out] mask Changed fields, merged into.
+/// @return Number of changed fields.
+///
+int pb_diff(const pb_t &pb, const pb_t &shadow, pb_mask *mask);
+
+///
+/// Copy masked fields, unset fields in `src` are cleared in `dst`.
+/// @param[out] dst Protobuf object.
+/// @param[in] src Protobuf object with same type.
+/// @param[in] mask Fields to copy.
+///
+void pb_copy(pb_t *dst, const pb_t &src, const pb_mask &mask);
+
+///
+/// Encode masked fields as delta: mask words, then a partial message.
+/// @param[in] pb Protobuf object.
+/// @param[in] mask Changed fields.
+/// @param[out] out Delta data, appended.
+///
+void pb_delta(const pb_t &pb, const pb_mask &mask, std::string *out);
+
+///
+/// Apply delta encoded by `pb_delta`.
+/// @param[out] pb Protobuf object.
+/// @param[in] data Delta data.
+/// @param[in] len Delta length.
+/// @return true if succeeded.
+///
+bool pb_apply(pb_t *pb, const char *data, int len);
+
+///
+/// Format masked singular scalar fields as SQL assignments, e.g.
+/// "`hp`=100,`name`='fox'", strings are escaped by `db_escape`. Nested and
+/// repeated fields are skipped as they are not columns.
+/// @param[in] pb Protobuf object.
+/// @param[in] mask Changed fields.
+/// @param[out] out SQL assignments, appended.
+/// @return Number of columns.
+///
+int pb_columns(const pb_t &pb, const pb_mask &mask, std::string *out);
 } // namespace elf
 
 #endif /* !ELF_PB_H */
@@ -8,6 +8,9 @@
 namespace elf {
 #define EPOCHFILETIME 116444736000000000LL
 
+static time64_t s_frame_mono; // cached by time_update
+static time64_t s_frame_ms;
+
 /**
  * Do same thing as Linux.
  */
@@ -54,6 +57,59 @@ time64_t time_ms(void)
 #endif
 }
 
+time64_t time_mono(void)
+{
+#if defined(ELF_PLATFORM_WIN32)
+    return GetTickCount64();
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((time64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+#endif
+}
+
+time64_t time_mono_coarse(void)
+{
+#if defined(CLOCK_MONOTONIC_COARSE)
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ((time64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+#else
+    return time_mono();
+#endif
+}
+
+time64_t time_update(void)
+{
+    time64_t mono = time_mono();
+
+    // read by other threads
+    __atomic_store_n(&s_frame_ms, time_ms(), __ATOMIC_RELAXED);
+    __atomic_store_n(&s_frame_mono, mono, __ATOMIC_RELAXED);
+    return mono;
+}
+
+time64_t time_frame_mono(void)
+{
+    time64_t mono = __atomic_load_n(&s_frame_mono, __ATOMIC_RELAXED);
+
+    return (mono != 0) ? mono : time_mono();
+}
+
+time64_t time_frame_ms(void)
+{
+    time64_t ms = __atomic_load_n(&s_frame_ms, __ATOMIC_RELAXED);
+
+    return (ms != 0) ? ms : time_ms();
+}
+
+time_t time_frame_s(void)
+{
+    return (time_t)(time_frame_ms() / 1000);
+}
+
 time64_t time_diff(time64_t end, time64_t start)
 {
     return (end - start);
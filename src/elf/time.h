@@ -40,17 +40,57 @@ struct timeval
 #endif /* ELF_PLATFORM_WIN32 */
 
 ///
-/// time(in second).
+/// time(in second), wall clock.
 /// @return Current time.
 ///
 time_t time_s(void);
 
 ///
-/// gettimeofday(in millisecond).
+/// gettimeofday(in millisecond), wall clock which may be stepped by NTP.
 /// @return Current time.
 ///
 time64_t time_ms(void);
 
+///
+/// Monotonic clock(in millisecond), for intervals and deadlines.
+/// @return Milliseconds since an unspecified point(boot).
+///
+time64_t time_mono(void);
+
+///
+/// Coarse monotonic clock(in millisecond), cheaper but only accurate to
+/// a tick(1-4ms). The same as time_mono if not supported.
+/// @return Milliseconds since an unspecified point(boot).
+///
+time64_t time_mono_coarse(void);
+
+///
+/// Refresh the cached frame time, called once per frame of the main loop
+/// (by timer_run).
+/// @return Monotonic time of the frame(ms).
+///
+time64_t time_update(void);
+
+///
+/// Get monotonic time of the current frame without syscalls, read the
+/// clock if never updated.
+/// @return Cached monotonic time(ms).
+///
+time64_t time_frame_mono(void);
+
+///
+/// Get wall clock time of the current frame without syscalls, read the
+/// clock if never updated.
+/// @return Cached wall clock time(ms).
+///
+time64_t time_frame_ms(void);
+
+///
+/// Get wall clock time of the current frame without syscalls.
+/// @return Cached wall clock time(s).
+///
+time_t time_frame_s(void);
+
 ///
 /// Calculate difference of time(in millisecond).
 /// @param[in] end End time.
@@ -3,13 +3,23 @@
  * http://www.yulefox.com/
  */
 
+#include <elf/lock.h>
 #include <elf/log.h>
 #include <elf/memory.h>
+#include <elf/thread.h>
 #include <elf/time.h>
 #include <elf/timer.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
 #include <algorithm>
 #include <list>
 #include <map>
+#include <string>
+#include <vector>
 
 namespace elf {
 #define WHEEL_SET_BIT0                  8
@@ -21,6 +31,20 @@ namespace elf {
 #define MAX_CURSOR                      (1LL << WHEEL_SET_BITS)
 #define MAX_LIFE                        (MAX_CURSOR * s_mgr.interval)
 #define FRAME_DIFFER(l, r)              (int)(l - r)
+#define TIMER_NODE_SIZE                 64 // cache line
+#define TIMER_SLAB_BITS                 10
+#define TIMER_SLAB_SIZE                 (1 << TIMER_SLAB_BITS) // nodes
+#define TIMER_SLAB_MAX                  4096
+#define TIMER_INDEX(id)                 (int)((id) & 0xffffffff)
+#define TIMER_GEN(id)                   (int)((id) >> 32) // [1, 2^31)
+#define TIMER_HANDLE(gen, idx)          (((oid_t)(gen) << 32) | (idx))
+#define OCCUPIED_SIZE                   (MAX_WHEEL_SET_SIZE / 64)
+#define TIMER_LABEL_MAX                 256
+#define TIMER_SNAPSHOT_MAGIC            0x524d5445 // "ETMR"
+#define TIMER_SNAPSHOT_VERSION          1
+#define TIMER_SNAPSHOT_ARGS_MAX         (1 << 20) // packed args of a record
+#define OCCUPIED_SET(b)     (s_mgr.occupied[(b) >> 6] |= (1ULL << ((b) & 63)))
+#define OCCUPIED_CLR(b)     (s_mgr.occupied[(b) >> 6] &= ~(1ULL << ((b) & 63)))
 
 union cursor_t {
     struct wheel_t {
@@ -33,22 +57,78 @@ union cursor_t {
     int a;
 };
 
+// TIMER_NODE_SIZE bytes, allocated from slabs
 struct timer_t {
-    oid_t id; // identification
-    time64_t life; // life from now
-    cursor_t cursor; // expired frame
-    bool script;
+    timer_t *next; // the next node of the tail node is NULL
+    timer_t *prev; // the previous node of the head node is the tail
+    oid_t id; // handle: generation and index of node
+    time64_t life; // life from now, or period of repeating timer
+    void *args; // callback arguments
     union cb_t {
-        char script[1024]; // script function name
         callback func; // callback function
+        batch_callback batch; // callback of coalesced timers
+        int script; // index of interned script function name
     };
     cb_t cb; // callback function
-    void *args; // callback arguments
-    timer_t *next; // the next node of the tail node is NULL
-    timer_t *prev; // the previous node of the head node is the tail
-    int bucket; // bucket index
+    cursor_t cursor; // expired frame
+    short bucket; // bucket index, -1 if not in wheel
+    unsigned short phase; // ms after cursor(TIMER_FIXED_RATE)
+    unsigned char mode; // timer_mode
+    bool script;
+    bool batch; // coalesced timers, args is batch_t
     bool manual; // manual destroy args
-    bool cancel; // cancel flag, false if deleted
+    bool cancel; // cancelled while running
+    unsigned char label; // index of label, 0 if not labeled
+};
+
+// profile of timers with the same label
+struct label_t : public timer_label_t {
+    std::string name;
+};
+
+// args of coalesced timers
+struct batch_t {
+    std::vector<void *> args;
+    size_t offset; // args before it have been handled
+    int budget; // max args handled per frame, 0 if unlimited
+};
+
+// registered callback, restorable from snapshot
+struct handler_t {
+    std::string name;
+    callback func;
+    timer_pack pack;
+    timer_unpack unpack;
+};
+
+// snapshot file header
+struct snapshot_t {
+    int magic;
+    int version;
+    time64_t time; // wall clock time of saving(ms)
+    int num; // number of timers
+};
+
+// timer in snapshot file, followed by name, label and packed args
+struct record_t {
+    long long remain; // time to the next expiry(ms)
+    long long life; // life or period(ms)
+    unsigned char mode;
+    bool script;
+    bool manual;
+    unsigned char reserved;
+    unsigned short name_len;
+    unsigned short label_len;
+    int args_len;
+};
+
+// operation submitted by other threads
+struct oper_t {
+    oper_t *next;
+    timer_t *timer; // timer to add, NULL for cancelling
+    oid_t tid; // timer to cancel
+    time64_t time; // submitted time
+    time64_t delay; // delay of the timer to add
 };
 
 struct mgr_t {
@@ -64,20 +144,50 @@ struct mgr_t {
     int timer_remain; // remain timers
     int timer_passed; // total number of passed timers
     int timer_cancelled; // total number of cancelled timers
+    int rehash_num; // number of cascaded buckets
+    int rehash_moved; // number of timers moved by cascading
     bool pause; // suspend all timers
+    bool profile; // profile lateness and callback time
+    int fd; // timerfd armed with next deadline, -1 if not hires mode
+    bool running; // in timer_run, timerfd armed after it
+    time64_t lowres_interval; // interval before hires mode
+    time64_t armed_time; // time the timerfd armed for, 0 if disarmed
     timer_t *timers[MAX_WHEEL_SET_SIZE];
+    uint64_t occupied[OCCUPIED_SIZE]; // bitmap of non-empty buckets
 };
 
 typedef std::list<callback> handler_list;
-typedef std::map<oid_t, timer_t*> timer_map;
+typedef std::map<std::string, int> script_map;
+typedef std::map<std::string, int> label_map;
+typedef std::map<std::string, handler_t *> handler_map;
+typedef std::map<callback, handler_t *> handler_func_map;
+typedef std::pair<int, batch_callback> batch_key;
+typedef std::map<batch_key, timer_t *> batch_map;
 
 static handler_list s_handlers;
+static time64_t s_min_due; // wall-clock minute _timer_min is due at
+static std::vector<std::string> s_scripts; // interned script function names
+static script_map s_script_ids;
+static timer_t *s_slabs[TIMER_SLAB_MAX];
+static int s_slab_num;
+static timer_t *s_free_nodes; // linked by next
+static int s_node_used;
+static spin_t s_pool_lock; // nodes may be allocated by other threads
+static spin_t s_script_lock;
+static label_t *s_labels[TIMER_LABEL_MAX];
+static int s_label_num;
+static label_map s_label_ids;
+static batch_map s_batches; // coalesced timers by deadline and callback
+static handler_map s_named_handlers; // registered callbacks
+static handler_func_map s_func_handlers;
+static thread_t s_owner; // thread running timers
+static oper_t *s_opers; // submitted operations(LIFO)
+static __thread oid_t s_submitted; // id returned to other threads
 
 static const time64_t TIMER_FRAME_INTERVAL_DEFAULT = 50; // (ms)
 static const time64_t TIMER_FRAME_INTERVAL_MIN = 1; // (frame)
 static const time64_t TIMER_FRAME_INTERVAL_MAX = 1000; // (frame)
 static mgr_t s_mgr;
-static timer_map s_timers;
 
 /// calculate the number of life frames
 #define FRAME_CALC(t) ((time64_t)(t) / s_mgr.interval)
@@ -101,41 +211,70 @@ static timer_map s_timers;
 
 
 static void _reset(void);
+static void _rescale(time64_t interval);
+static void _run(void);
+static void _arm(void);
+static void _arm_time(int ms);
+static bool _owned(void);
+static void _drain(void);
+static void _submit(timer_t *t, oid_t tid, time64_t delay);
+static void _start(timer_t *t, time64_t delay);
+static void _repeat(timer_t *t);
+static int _real_cursor(time64_t now);
+static timer_t *_alloc(void);
+static timer_t *_find(const oid_t &tid);
+static int _intern(const char *func);
+static int _label(const char *label);
+static void _profile(timer_t *t, time64_t now, time64_t cost);
+static void _hist_add(int *hist, long long v);
+static long long _hist_percent(const int *hist, int num, int percent);
+static time64_t _time_us(void);
+static bool _save(FILE *fp, timer_t *t, time64_t now);
+static int _load(FILE *fp, int policy, time64_t down, id_list *tids);
 static void _destroy(timer_t *t);
 static void _schedule(timer_t *t);
 static void _add(timer_t *t);
+static void _unlink(timer_t *t);
 static void _cancel(timer_t *t);
 static void _expire(timer_t *t);
+static bool _expire_batch(timer_t *t);
 static void _bingo(void);
+static int _skip(int frame);
+static int _next_occupied(int from);
 static void _rehash(int bucket);
 static bool _timer_min(void *args);
+static time64_t _min_delay(void);
 
 int timer_init(void)
 {
     MODULE_IMPORT_SWITCH;
+    spin_init(&s_pool_lock);
+    spin_init(&s_script_lock);
+    s_owner = pthread_self();
+    s_mgr.fd = -1;
+    s_mgr.running = false;
+    s_mgr.armed_time = 0;
     s_mgr.interval = TIMER_FRAME_INTERVAL_DEFAULT;
-    s_mgr.start_time = s_mgr.last_time = time_ms();
+    s_mgr.start_time = s_mgr.last_time = time_mono();
     s_mgr.pause = true;
     s_mgr.cursor.a = 0;
     s_mgr.round = 0;
     memset(s_mgr.timers, 0, sizeof(s_mgr.timers[0]) * MAX_WHEEL_SET_SIZE);
+    memset(s_mgr.occupied, 0, sizeof(s_mgr.occupied));
+    s_labels[0] = E_NEW label_t();
+    s_labels[0]->name = "-";
+    s_label_num = 1;
 
-    time_t ms = time_ms() % 1000;
-    time_t cur = time_s();
-    time64_t tm_timer;
-    struct tm tm_cur;
-
-    localtime_r(&cur, &tm_cur);
-    tm_timer = (60 - tm_cur.tm_sec) * 1000llu - ms;
-
-    timer_add(tm_timer, _timer_min, NULL, true);
+    s_min_due = time_ms() / 60000 * 60000;
+    timer_add(_min_delay(), _timer_min, NULL, true);
     return 0;
 }
 
 int timer_fini(void)
 {
     MODULE_IMPORT_SWITCH;
-    s_mgr.end_time = time_ms();
+    s_mgr.end_time = time_mono();
+    _drain();
     for (int i = 0; i < MAX_WHEEL_SET_SIZE; ++i) {
         timer_t *head = s_mgr.timers[i];
         timer_t *t = head;
@@ -148,17 +287,89 @@ int timer_fini(void)
             t = n;
         }
     }
+    for (int i = 0; i < s_slab_num; ++i) {
+        free(s_slabs[i]);
+    }
+    s_slab_num = 0;
+    s_free_nodes = NULL;
+    for (int i = 0; i < s_label_num; ++i) {
+        E_DELETE(s_labels[i]);
+        s_labels[i] = NULL;
+    }
+    s_label_num = 0;
+    s_label_ids.clear();
+
+    handler_map::iterator itr = s_named_handlers.begin();
+
+    for (; itr != s_named_handlers.end(); ++itr) {
+        E_DELETE(itr->second);
+    }
+    s_named_handlers.clear();
+    s_func_handlers.clear();
+    spin_fini(&s_script_lock);
+    spin_fini(&s_pool_lock);
+    timer_lowres();
     return 0;
 }
 
 void timer_run(void)
+{
+    time_update();
+    if (s_mgr.fd >= 0) {
+        uint64_t expired = 0;
+
+        if (read(s_mgr.fd, &expired, sizeof(expired)) < 0) {
+            // EAGAIN, called without expiry
+        }
+        s_mgr.running = true; // armed after running
+    }
+    _drain();
+    _run();
+    if (s_mgr.fd >= 0) {
+        s_mgr.running = false;
+        _arm();
+    }
+}
+
+int timer_hires(time64_t interval)
+{
+    if (s_mgr.fd < 0) {
+        s_mgr.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (s_mgr.fd < 0) {
+            LOG_ERROR("timer", "timerfd_create FAILED: %s.", strerror(errno));
+            return -1;
+        }
+        s_mgr.lowres_interval = s_mgr.interval;
+    }
+    timer_interval(interval);
+    _arm();
+    return s_mgr.fd;
+}
+
+void timer_lowres(void)
+{
+    if (s_mgr.fd < 0) {
+        return;
+    }
+    close(s_mgr.fd);
+    s_mgr.fd = -1;
+    s_mgr.armed_time = 0;
+    timer_interval(s_mgr.lowres_interval);
+}
+
+int timer_fd(void)
+{
+    return s_mgr.fd;
+}
+
+static void _run(void)
 {
     if (s_mgr.pause || s_mgr.timer_remain <= 0) {
         return;
     }
 
     // frame may greater than 1 while CPU busying
-    s_mgr.cur_time = time_ms();
+    s_mgr.cur_time = time_frame_mono();
     int frame = FRAME_BINGO;
 
     // time anomaly
@@ -177,35 +388,239 @@ void timer_run(void)
                 s_mgr.cur_time, s_mgr.last_time,
                 frame);
     }
-    for (int i = 1; i <= frame; ++i) { // BINGO!
-        unsigned char bucket = CURRENT_WHEEL_CURSOR;
-        timer_t *head = s_mgr.timers[bucket];
-        timer_t *t = head;
+    while (frame > 0) { // BINGO!
+        int skip = _skip(frame);
 
-        s_mgr.timers[bucket] = NULL;
-        while (t != NULL) { // expire all timers
-            timer_t *n = t->next;
+        if (skip > 0) { // empty buckets
+            s_mgr.cursor.a += skip;
+            frame -= skip;
+            continue;
+        }
 
-            if (t->cancel) {
-                _cancel(t);
-            } else {
-                _expire(t);
-            }
-            if (n == head) {
-                break;
-            }
-            t = n;
+        unsigned char bucket = CURRENT_WHEEL_CURSOR;
+        timer_t *t = NULL;
+
+        // callbacks may cancel timers in this bucket, no new ones added
+        while ((t = s_mgr.timers[bucket]) != NULL) { // expire all timers
+            _unlink(t);
+            _expire(t);
         }
         _bingo();
+        --frame;
+    }
+}
+
+int timer_next_deadline(void)
+{
+    if (s_opers != NULL) {
+        return 0;
     }
+    if (s_mgr.pause || s_mgr.timer_remain <= 0) {
+        return -1;
+    }
+
+    // wake up at the end of wheel 0 at least, for rehashing
+    int cur = CURRENT_WHEEL_CURSOR;
+    int frames = std::min(_next_occupied(cur), WHEEL_SET_SIZE0 - 1) - cur;
+    time64_t due = s_mgr.last_time + s_mgr.interval
+        * (FRAME_DIFFER(s_mgr.cursor.a, s_mgr.last_cursor) + frames + 1);
+    time64_t now = time_mono();
+
+    return (due > now) ? (int)(due - now) : 0;
 }
 
 void timer_stat(void)
 {
     LOG_INFO("timer",
-            "ST: %lld RND: %u FRM: %u TMT: %u TMP: %u TMC: %u.",
+            "ST: %lld RND: %u FRM: %u TMT: %u TMP: %u TMC: %u"
+            " NODE: %d/%d SCRIPT: %d.",
             s_mgr.start_time, s_mgr.round, s_mgr.cursor.a,
-            s_mgr.timer_total, s_mgr.timer_passed, s_mgr.timer_cancelled);
+            s_mgr.timer_total, s_mgr.timer_passed, s_mgr.timer_cancelled,
+            s_node_used, s_slab_num * TIMER_SLAB_SIZE, (int)s_scripts.size());
+    LOG_INFO("timer", "REHASH: %d MOVED: %d.",
+            s_mgr.rehash_num, s_mgr.rehash_moved);
+    if (!s_mgr.profile) {
+        return;
+    }
+
+    int num = __atomic_load_n(&s_label_num, __ATOMIC_ACQUIRE);
+
+    for (int i = 0; i < num; ++i) {
+        const label_t *l = s_labels[i];
+
+        if (l->fired == 0) {
+            continue;
+        }
+        LOG_INFO("timer",
+                "%-24s N: %d LATE(ms) P50: %lld P99: %lld MAX: %lld"
+                " COST(us) AVG: %lld P99: %lld MAX: %lld.",
+                l->name.c_str(), l->fired,
+                std::min(_hist_percent(l->lates, l->fired, 50), l->late_max),
+                std::min(_hist_percent(l->lates, l->fired, 99), l->late_max),
+                l->late_max, (long long)(l->cost / l->fired),
+                std::min(_hist_percent(l->costs, l->fired, 99),
+                    (long long)l->cost_max),
+                (long long)l->cost_max);
+    }
+}
+
+void timer_profile(bool enable)
+{
+    s_mgr.profile = enable;
+}
+
+void timer_counter(timer_counter_t *counter)
+{
+    assert(counter);
+    counter->total = s_mgr.timer_total;
+    counter->remain = s_mgr.timer_remain;
+    counter->passed = s_mgr.timer_passed;
+    counter->cancelled = s_mgr.timer_cancelled;
+    counter->rehash_num = s_mgr.rehash_num;
+    counter->rehash_moved = s_mgr.rehash_moved;
+}
+
+bool timer_profile(const char *label, timer_label_t *prof)
+{
+    assert(prof);
+
+    int idx = 0;
+
+    if (label != NULL && label[0] != '\0') {
+        spin lock(&s_script_lock);
+        label_map::const_iterator itr = s_label_ids.find(label);
+
+        if (itr == s_label_ids.end()) {
+            return false;
+        }
+        idx = itr->second;
+    }
+    *prof = *(s_labels[idx]);
+    return true;
+}
+
+int timer_regist(const char *name, callback func,
+        timer_pack pack, timer_unpack unpack)
+{
+    assert(name && func);
+    if (s_named_handlers.find(name) != s_named_handlers.end()
+            || s_func_handlers.find(func) != s_func_handlers.end()) {
+        LOG_WARN("timer", "Callback `%s` registered ALREADY.", name);
+        return -1;
+    }
+
+    handler_t *h = E_NEW handler_t;
+
+    h->name = name;
+    h->func = func;
+    h->pack = pack;
+    h->unpack = unpack;
+    s_named_handlers[name] = h;
+    s_func_handlers[func] = h;
+    return 0;
+}
+
+int timer_save(const char *path)
+{
+    assert(path);
+    _drain();
+
+    std::string tmp = std::string(path) + ".tmp";
+    FILE *fp = fopen(tmp.c_str(), "wb");
+
+    if (fp == NULL) {
+        LOG_ERROR("timer", "Open `%s` FAILED: %s.",
+                tmp.c_str(), strerror(errno));
+        return -1;
+    }
+
+    snapshot_t ss;
+    time64_t now = time_mono();
+    int skipped = 0;
+
+    memset(&ss, 0, sizeof(ss));
+    ss.magic = TIMER_SNAPSHOT_MAGIC;
+    ss.version = TIMER_SNAPSHOT_VERSION;
+    ss.time = time_ms();
+    fwrite(&ss, sizeof(ss), 1, fp);
+    for (int i = 0; i < MAX_WHEEL_SET_SIZE; ++i) {
+        timer_t *head = s_mgr.timers[i];
+        timer_t *t = head;
+
+        while (t) {
+            if (t->script || t->batch || t->cb.func != _timer_min) {
+                if (_save(fp, t, now)) {
+                    ++ss.num;
+                } else {
+                    ++skipped;
+                }
+            }
+            t = t->next;
+            if (t == head) break;
+        }
+    }
+    rewind(fp);
+    fwrite(&ss, sizeof(ss), 1, fp);
+
+    bool failed = (ferror(fp) != 0);
+
+    fclose(fp);
+    if (failed || rename(tmp.c_str(), path) != 0) {
+        LOG_ERROR("timer", "Save `%s` FAILED: %s.", path, strerror(errno));
+        remove(tmp.c_str());
+        return -1;
+    }
+    LOG_INFO("timer", "%d timers saved into `%s`, %d skipped.",
+            ss.num, path, skipped);
+    return ss.num;
+}
+
+int timer_load(const char *path, int policy, id_list *tids)
+{
+    assert(path);
+    assert(policy == TIMER_CATCHUP_FIRE || policy == TIMER_CATCHUP_DROP);
+
+    FILE *fp = fopen(path, "rb");
+
+    if (fp == NULL) {
+        LOG_WARN("timer", "Open `%s` FAILED: %s.", path, strerror(errno));
+        return -1;
+    }
+
+    snapshot_t ss;
+
+    if (fread(&ss, sizeof(ss), 1, fp) != 1
+            || ss.magic != TIMER_SNAPSHOT_MAGIC
+            || ss.version != TIMER_SNAPSHOT_VERSION) {
+        LOG_ERROR("timer", "Load `%s` FAILED: invalid snapshot.", path);
+        fclose(fp);
+        return -1;
+    }
+
+    time64_t cur = time_ms();
+    time64_t down = (cur > ss.time) ? cur - ss.time : 0;
+    int num = 0;
+
+    for (int i = 0; i < ss.num; ++i) {
+        if (feof(fp) || ferror(fp)) {
+            LOG_ERROR("timer", "Load `%s` FAILED: truncated at %d/%d.",
+                    path, i, ss.num);
+            break;
+        }
+
+        int rc = _load(fp, policy, down, tids);
+
+        if (rc < 0) {
+            LOG_ERROR("timer", "Load `%s` FAILED: corrupt record at %d/%d.",
+                    path, i, ss.num);
+            break;
+        }
+        num += rc;
+    }
+    fclose(fp);
+    LOG_INFO("timer", "%d/%d timers restored from `%s`, down %lld ms.",
+            num, ss.num, path, down);
+    return num;
 }
 
 int timer_size(void)
@@ -213,7 +628,7 @@ int timer_size(void)
     return s_mgr.timer_remain;
 }
 
-const oid_t &timer_add(time64_t life, const char *func)
+const oid_t &timer_add(time64_t life, const char *func, const char *label)
 {
     if (life < 0 || life >= MAX_LIFE) {
         LOG_WARN("timer",
@@ -222,25 +637,29 @@ const oid_t &timer_add(time64_t life, const char *func)
         return OID_NIL;
     }
 
-    timer_t *t = E_NEW timer_t;
+    timer_t *t = _alloc();
 
-    memset(t, 0, sizeof(*t));
-    t->id = oid_gen();
+    if (t == NULL) {
+        return OID_NIL;
+    }
     t->life = std::max(life, s_mgr.interval);
-    t->cursor.a = (FRAME_CALC(t->life) + s_mgr.cursor.a) % MAX_CURSOR;
     t->script = true;
-    strcpy(t->cb.script, func);
+    t->cb.script = _intern(func);
     t->args = NULL;
     t->manual = true;
     t->cancel = false;
-    _schedule(t);
-    s_timers[t->id] = t;
-    ++s_mgr.timer_total;
-    ++s_mgr.timer_remain;
+    t->label = _label(label);
+    if (!_owned()) {
+        s_submitted = t->id;
+        _submit(t, OID_NIL, t->life);
+        return s_submitted;
+    }
+    _start(t, t->life);
     return t->id;
 }
 
-const oid_t &timer_add(time64_t life, callback func, void *args, bool manual)
+const oid_t &timer_add(time64_t life, callback func, void *args, bool manual,
+        const char *label)
 {
     if (life < 0 || life >= MAX_LIFE) {
         LOG_WARN("timer",
@@ -248,27 +667,113 @@ const oid_t &timer_add(time64_t life, callback func, void *args, bool manual)
                 life, MAX_LIFE);
         return OID_NIL;
     }
-    if (life == 0) {
+    if (life == 0 && _owned()) {
         func(args);
         E_FREE(args);
         return OID_NIL;
     }
 
-    timer_t *t = E_NEW timer_t;
+    timer_t *t = _alloc();
 
-    memset(t, 0, sizeof(*t));
-    t->id = oid_gen();
+    if (t == NULL) {
+        return OID_NIL;
+    }
     t->life = std::max(life, s_mgr.interval);
-    t->cursor.a = (FRAME_CALC(t->life) + s_mgr.cursor.a) % MAX_CURSOR;
     t->script = false;
     t->cb.func = func;
     t->args = args;
     t->manual = manual;
     t->cancel = false;
-    _schedule(t);
-    s_timers[t->id] = t;
-    ++s_mgr.timer_total;
-    ++s_mgr.timer_remain;
+    t->label = _label(label);
+    if (!_owned()) {
+        s_submitted = t->id;
+        _submit(t, OID_NIL, t->life);
+        return s_submitted;
+    }
+    _start(t, t->life);
+    return t->id;
+}
+
+const oid_t &timer_repeat(time64_t delay, time64_t period,
+        callback func, void *args, bool manual, int mode, const char *label)
+{
+    if (delay < 0 || delay >= MAX_LIFE || period <= 0 || period >= MAX_LIFE) {
+        LOG_WARN("timer",
+                "Timer added FAILED: invalid timer delay/period(%lld/%lld)"
+                " [0, %lld).",
+                delay, period, MAX_LIFE);
+        return OID_NIL;
+    }
+    assert(mode == TIMER_FIXED_RATE || mode == TIMER_FIXED_DELAY);
+
+    timer_t *t = _alloc();
+
+    if (t == NULL) {
+        return OID_NIL;
+    }
+    delay = std::max(delay, s_mgr.interval);
+    t->life = std::max(period, s_mgr.interval);
+    t->mode = mode;
+    t->script = false;
+    t->cb.func = func;
+    t->args = args;
+    t->manual = manual;
+    t->cancel = false;
+    t->label = _label(label);
+    if (!_owned()) {
+        s_submitted = t->id;
+        _submit(t, OID_NIL, delay);
+        return s_submitted;
+    }
+    _start(t, delay);
+    return t->id;
+}
+
+const oid_t &timer_batch(time64_t life, batch_callback func, void *args,
+        bool manual, int budget)
+{
+    assert(_owned());
+    if (life < 0 || life >= MAX_LIFE) {
+        LOG_WARN("timer",
+                "Timer added FAILED: invalid timer life(%lld) [0, %lld).",
+                life, MAX_LIFE);
+        return OID_NIL;
+    }
+    life = std::max(life, s_mgr.interval);
+
+    batch_key key((FRAME_CALC(life) + s_mgr.cursor.a) % MAX_CURSOR, func);
+    batch_map::const_iterator itr = s_batches.find(key);
+
+    if (itr != s_batches.end()) { // coalesced into the same node
+        batch_t *b = (batch_t *)itr->second->args;
+
+        b->args.push_back(args);
+        if (b->budget > 0) { // 0 for unlimited
+            b->budget = (budget > 0) ? std::max(b->budget, budget) : 0;
+        }
+        return itr->second->id;
+    }
+
+    timer_t *t = _alloc();
+
+    if (t == NULL) {
+        return OID_NIL;
+    }
+
+    batch_t *b = E_NEW batch_t;
+
+    b->args.push_back(args);
+    b->offset = 0;
+    b->budget = budget;
+    t->life = life;
+    t->script = false;
+    t->batch = true;
+    t->cb.batch = func;
+    t->args = b;
+    t->manual = manual;
+    t->cancel = false;
+    _start(t, life);
+    s_batches[key] = t;
     return t->id;
 }
 
@@ -303,8 +808,11 @@ void timer_resume(const oid_t &tid)
 void timer_interval(time64_t t)
 {
     assert(t >= TIMER_FRAME_INTERVAL_MIN && t <= TIMER_FRAME_INTERVAL_MAX);
-    s_mgr.interval = t;
-    _reset();
+    if (t == s_mgr.interval) {
+        _reset();
+        return;
+    }
+    _rescale(t);
 }
 
 void timer_bucket(unsigned char no, int l)
@@ -328,11 +836,22 @@ void timer_bucket(unsigned char no, int l)
 
 void timer_cancel(const oid_t &tid)
 {
-    timer_map::iterator itr = s_timers.find(tid);
-    if (itr != s_timers.end()) {
-        timer_t *t = itr->second;
+    if (!_owned()) {
+        _submit(NULL, tid, 0);
+        return;
+    }
+
+    timer_t *t = _find(tid);
+
+    if (t == NULL) {
+        return;
+    }
+    if (t->bucket < 0) { // running or submitted, released later
         t->cancel = true;
+        return;
     }
+    _unlink(t);
+    _cancel(t);
 }
 
 static void _add(timer_t *t)
@@ -350,6 +869,27 @@ static void _add(timer_t *t)
     }
     head->prev = t;
     t->next = head;
+    OCCUPIED_SET(bucket);
+}
+
+static void _unlink(timer_t *t)
+{
+    assert(t && t->bucket >= 0);
+
+    timer_t *&head = s_mgr.timers[t->bucket];
+
+    if (t->next == t) {
+        head = NULL;
+        OCCUPIED_CLR(t->bucket);
+    } else {
+        t->prev->next = t->next;
+        t->next->prev = t->prev;
+        if (head == t) {
+            head = t->next;
+        }
+    }
+    t->next = t->prev = NULL;
+    t->bucket = -1;
 }
 
 
@@ -364,30 +904,639 @@ static void _cancel(timer_t *t)
 static void _expire(timer_t *t)
 {
     assert(t);
+
+    bool again = true;
+    time64_t now = 0;
+    time64_t start = 0;
+
+    if (s_mgr.profile) {
+        now = time_mono();
+        start = _time_us();
+    }
     if (t->script) {
-        // script_func_exec(t->cb.script, 0);
+        // script_func_exec(s_scripts[t->cb.script].c_str(), 0);
+    } else if (t->batch) {
+        again = _expire_batch(t);
     } else {
-        t->cb.func(t->args);
+        again = t->cb.func(t->args);
+    }
+    if (s_mgr.profile) {
+        _profile(t, now, _time_us() - start);
     }
-    _destroy(t);
     ++s_mgr.timer_passed;
+    if (t->batch && again && !t->cancel) { // the rest in the next frame
+        t->cursor.a = (s_mgr.cursor.a + 1) % MAX_CURSOR;
+        _schedule(t);
+        return;
+    }
+    if (t->mode != TIMER_ONCE && again && !t->cancel) {
+        _repeat(t);
+        return;
+    }
+    _destroy(t);
     --s_mgr.timer_remain;
 }
 
+///
+/// Call batch callback with args of coalesced timers, within the budget.
+/// @return true if there are args left.
+///
+static bool _expire_batch(timer_t *t)
+{
+    batch_t *b = (batch_t *)t->args;
+    batch_map::iterator itr = s_batches.find(batch_key(t->cursor.a,
+                t->cb.batch));
+
+    if (itr != s_batches.end() && itr->second == t) { // no more coalescing
+        s_batches.erase(itr);
+    }
+
+    size_t num = b->args.size() - b->offset;
+
+    if (b->budget > 0) {
+        num = std::min(num, (size_t)b->budget);
+    }
+    t->cb.batch(&b->args[b->offset], (int)num);
+    if (!t->manual) {
+        for (size_t i = b->offset; i < b->offset + num; ++i) {
+            E_FREE(b->args[i]);
+        }
+    }
+    b->offset += num;
+    return b->offset < b->args.size();
+}
+
+static bool _owned(void)
+{
+    return pthread_equal(pthread_self(), s_owner);
+}
+
+///
+/// Push operation from other threads, applied by the next timer_run.
+/// @param t Timer to add, NULL for cancelling.
+/// @param tid Timer to cancel.
+/// @param delay Delay of the timer to add.
+///
+static void _submit(timer_t *t, oid_t tid, time64_t delay)
+{
+    oper_t *op = E_NEW oper_t;
+
+    op->timer = t;
+    op->tid = tid;
+    op->time = time_mono();
+    op->delay = delay;
+    do {
+        op->next = s_opers;
+    } while (!__sync_bool_compare_and_swap(&s_opers, op->next, op));
+    if (op->next == NULL && s_mgr.fd >= 0) { // wake up timer_run
+        _arm_time(0);
+    }
+}
+
+///
+/// Apply submitted operations in order.
+///
+static void _drain(void)
+{
+    if (s_opers == NULL) {
+        return;
+    }
+
+    oper_t *op = __sync_lock_test_and_set(&s_opers, (oper_t *)NULL);
+    oper_t *fifo = NULL;
+
+    while (op != NULL) {
+        oper_t *n = op->next;
+
+        op->next = fifo;
+        fifo = op;
+        op = n;
+    }
+    for (op = fifo; op != NULL; op = fifo) {
+        timer_t *t = op->timer;
+
+        fifo = op->next;
+        if (t == NULL) {
+            timer_cancel(op->tid);
+        } else if (t->cancel) { // cancelled before scheduled
+            _destroy(t);
+            ++s_mgr.timer_total;
+            ++s_mgr.timer_cancelled;
+        } else {
+            time64_t elapsed = time_mono() - op->time;
+            time64_t delay = (op->delay > elapsed) ? op->delay - elapsed : 0;
+
+            _start(t, std::max(delay, s_mgr.interval));
+        }
+        E_DELETE(op);
+    }
+}
+
+///
+/// Schedule new timer, in owner thread.
+/// @param delay Delay of the first expiry.
+///
+static void _start(timer_t *t, time64_t delay)
+{
+    t->cursor.a = (FRAME_CALC(delay) + s_mgr.cursor.a) % MAX_CURSOR;
+    t->phase = delay % s_mgr.interval;
+    _schedule(t);
+    ++s_mgr.timer_total;
+    ++s_mgr.timer_remain;
+    if (s_mgr.fd >= 0 && !s_mgr.running) { // earlier than armed
+        time64_t due = s_mgr.last_time + s_mgr.interval
+            * (FRAME_DIFFER(t->cursor.a, s_mgr.last_cursor) + 1);
+
+        if (s_mgr.armed_time == 0 || due < s_mgr.armed_time) {
+            _arm();
+        }
+    }
+}
+
+///
+/// Reschedule repeating timer in place.
+/// TIMER_FIXED_RATE: from the expected expiry, missed periods(while
+/// catching up) are skipped to keep the phase.
+/// TIMER_FIXED_DELAY: from the end of the callback.
+///
+static void _repeat(timer_t *t)
+{
+    if (t->mode == TIMER_FIXED_DELAY) { // the first frame due after it
+        time64_t due = time_mono() + t->life - s_mgr.last_time;
+        int cursor = s_mgr.last_cursor - 1
+            + (due + s_mgr.interval - 1) / s_mgr.interval;
+
+        if (FRAME_DIFFER(cursor, s_mgr.cursor.a) <= 0) {
+            cursor = s_mgr.cursor.a + 1;
+        }
+        t->cursor.a = cursor % MAX_CURSOR;
+        long long phase = (long long)due - (long long)s_mgr.interval
+            * (cursor - s_mgr.last_cursor);
+
+        t->phase = std::max(std::min(phase, (long long)s_mgr.interval), 0LL);
+        _schedule(t);
+        return;
+    }
+
+    time64_t next = t->phase + t->life; // ms after cursor
+    time64_t lag = (time64_t)FRAME_DIFFER(_real_cursor(s_mgr.cur_time),
+            t->cursor.a) * s_mgr.interval;
+
+    if (next < lag) {
+        next += (lag - next + t->life - 1) / t->life * t->life;
+    }
+    t->cursor.a = (FRAME_CALC(next) + t->cursor.a) % MAX_CURSOR;
+    t->phase = next % s_mgr.interval;
+    _schedule(t);
+}
+
+///
+/// Get the cursor of given time, frames before it are due.
+///
+static int _real_cursor(time64_t now)
+{
+    return s_mgr.last_cursor + FRAME_CALC(now - s_mgr.last_time);
+}
+
+///
+/// Arm timerfd with the next deadline.
+///
+static void _arm(void)
+{
+    int ms = timer_next_deadline();
+
+    if (ms < 0) {
+        _arm_time(-1);
+        s_mgr.armed_time = 0;
+        return;
+    }
+    _arm_time(ms);
+    s_mgr.armed_time = time_mono() + ms;
+    if (s_opers != NULL) { // submitted while arming
+        _arm_time(0);
+    }
+}
+
+///
+/// Arm timerfd relatively.
+/// @param ms Milliseconds, 0 for at once, -1 for disarming.
+///
+static void _arm_time(int ms)
+{
+    struct itimerspec its;
+
+    memset(&its, 0, sizeof(its));
+    if (ms == 0) {
+        its.it_value.tv_nsec = 1;
+    } else if (ms > 0) {
+        its.it_value.tv_sec = ms / 1000;
+        its.it_value.tv_nsec = (ms % 1000) * 1000000;
+    }
+    timerfd_settime(s_mgr.fd, 0, &its, NULL);
+}
+
 static void _reset(void)
 {
-    s_mgr.last_time = time_ms();
+    s_mgr.last_time = time_mono();
     s_mgr.last_cursor = s_mgr.cursor.a;
 }
 
+///
+/// Change frame interval, pending timers are rescheduled by their remaining
+/// time, cursors counted in the old frames would expire early or late.
+///
+static void _rescale(time64_t interval)
+{
+    typedef std::vector<std::pair<timer_t *, long long> > pending_list;
+
+    pending_list pending;
+    time64_t now = time_mono();
+
+    for (int i = 0; i < MAX_WHEEL_SET_SIZE; ++i) {
+        timer_t *head = s_mgr.timers[i];
+        timer_t *t = head;
+
+        while (t != NULL) {
+            timer_t *n = t->next;
+            time64_t due = s_mgr.last_time + t->phase + s_mgr.interval
+                * FRAME_DIFFER(t->cursor.a, s_mgr.last_cursor);
+
+            if (t->batch) {
+                batch_map::iterator itr = s_batches.find(
+                        batch_key(t->cursor.a, t->cb.batch));
+
+                if (itr != s_batches.end() && itr->second == t) {
+                    s_batches.erase(itr);
+                }
+            }
+            pending.push_back(std::make_pair(t, (long long)(due - now)));
+            t->next = t->prev = NULL;
+            t->bucket = -1;
+            if (n == head) break;
+            t = n;
+        }
+        s_mgr.timers[i] = NULL;
+    }
+    memset(s_mgr.occupied, 0, sizeof(s_mgr.occupied));
+    s_mgr.interval = interval;
+    _reset();
+
+    pending_list::const_iterator itr = pending.begin();
+
+    for (; itr != pending.end(); ++itr) {
+        timer_t *t = itr->first;
+        time64_t remain = (time64_t)std::max(itr->second, 0LL); // due
+
+        t->cursor.a = (FRAME_CALC(remain) + s_mgr.cursor.a) % MAX_CURSOR;
+        t->phase = remain % interval;
+        _schedule(t);
+        if (t->batch) {
+            s_batches.insert(std::make_pair(
+                        batch_key(t->cursor.a, t->cb.batch), t));
+        }
+    }
+}
+
+///
+/// Get a zeroed node from the pool, a new slab is allocated if run out.
+///
+static timer_t *_alloc(void)
+{
+    spin lock(&s_pool_lock);
+
+    if (s_free_nodes == NULL) {
+        if (s_slab_num >= TIMER_SLAB_MAX) {
+            LOG_WARN("timer", "Timer added FAILED: too many timers(%d).",
+                    s_node_used);
+            return NULL;
+        }
+
+        void *buf = NULL;
+
+        if (posix_memalign(&buf, TIMER_NODE_SIZE,
+                    sizeof(timer_t) * TIMER_SLAB_SIZE) != 0) {
+            return NULL;
+        }
+
+        timer_t *slab = (timer_t *)buf;
+        int base = s_slab_num << TIMER_SLAB_BITS;
+
+        s_slabs[s_slab_num] = slab;
+        for (int i = TIMER_SLAB_SIZE - 1; i >= 0; --i) {
+            slab[i].id = TIMER_HANDLE(1, base + i);
+            slab[i].next = s_free_nodes;
+            s_free_nodes = slab + i;
+        }
+        __atomic_store_n(&s_slab_num, s_slab_num + 1, __ATOMIC_RELEASE);
+    }
+
+    timer_t *t = s_free_nodes;
+    oid_t id = t->id;
+
+    s_free_nodes = t->next;
+    memset(t, 0, sizeof(*t));
+    t->id = id;
+    t->bucket = -1;
+    ++s_node_used;
+    return t;
+}
+
+///
+/// Find living timer by handle, stale handles are rejected by generation.
+///
+static timer_t *_find(const oid_t &tid)
+{
+    int idx = TIMER_INDEX(tid);
+
+    if (tid <= 0 || (idx >> TIMER_SLAB_BITS)
+            >= __atomic_load_n(&s_slab_num, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+
+    timer_t *t = s_slabs[idx >> TIMER_SLAB_BITS]
+        + (idx & (TIMER_SLAB_SIZE - 1));
+
+    return (t->id == tid) ? t : NULL;
+}
+
+///
+/// Intern script function name, shared by timers.
+/// @return Index of the name.
+///
+static int _intern(const char *func)
+{
+    assert(func);
+
+    spin lock(&s_script_lock);
+    script_map::const_iterator itr = s_script_ids.find(func);
+
+    if (itr != s_script_ids.end()) {
+        return itr->second;
+    }
+
+    int idx = s_scripts.size();
+
+    s_scripts.push_back(func);
+    s_script_ids[func] = idx;
+    return idx;
+}
+
+///
+/// Intern timer label, profiled separately.
+/// @return Index of the label, 0 if not labeled or too many labels.
+///
+static int _label(const char *label)
+{
+    if (label == NULL || label[0] == '\0') {
+        return 0;
+    }
+
+    spin lock(&s_script_lock);
+    label_map::const_iterator itr = s_label_ids.find(label);
+
+    if (itr != s_label_ids.end()) {
+        return itr->second;
+    }
+    if (s_label_num >= TIMER_LABEL_MAX) {
+        LOG_WARN("timer", "Too many timer labels, `%s` not profiled.", label);
+        return 0;
+    }
+
+    int idx = s_label_num;
+    label_t *l = E_NEW label_t();
+
+    l->name = label;
+    s_labels[idx] = l;
+    s_label_ids[label] = idx;
+    __atomic_store_n(&s_label_num, idx + 1, __ATOMIC_RELEASE);
+    return idx;
+}
+
+///
+/// Record lateness and callback time of expired timer.
+/// @param now Time the callback started.
+/// @param cost Callback time(us).
+///
+static void _profile(timer_t *t, time64_t now, time64_t cost)
+{
+    label_t *l = s_labels[t->label];
+    time64_t due = s_mgr.last_time + t->phase + s_mgr.interval
+        * FRAME_DIFFER(t->cursor.a, s_mgr.last_cursor);
+    long long late = (long long)(now - due); // negative if expired early
+
+    ++l->fired;
+    l->cost += cost;
+    l->cost_max = std::max(l->cost_max, cost);
+    l->late_max = (l->fired == 1) ? late : std::max(l->late_max, late);
+    _hist_add(l->costs, cost);
+    _hist_add(l->lates, late);
+}
+
+///
+/// Add value into log2 histogram, bucket i counts [2^(i-1), 2^i), bucket 0
+/// counts values less than 1.
+///
+static void _hist_add(int *hist, long long v)
+{
+    int i = (v <= 0) ? 0 : 64 - __builtin_clzll(v);
+
+    ++hist[std::min(i, TIMER_HIST_SIZE - 1)];
+}
+
+///
+/// Get percentile from log2 histogram.
+/// @return Upper bound of the bucket.
+///
+static long long _hist_percent(const int *hist, int num, int percent)
+{
+    long long rank = ((long long)num * percent + 99) / 100;
+
+    for (int i = 0; i < TIMER_HIST_SIZE; ++i) {
+        rank -= hist[i];
+        if (rank <= 0) {
+            return (i == 0) ? 0 : (1LL << i) - 1;
+        }
+    }
+    return 1LL << (TIMER_HIST_SIZE - 1);
+}
+
+///
+/// Monotonic time for profiling callbacks(us).
+///
+static time64_t _time_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (time64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+///
+/// Write timer into snapshot.
+/// @return false if the callback or args are not serialisable.
+///
+static bool _save(FILE *fp, timer_t *t, time64_t now)
+{
+    record_t r;
+    std::string name;
+    std::string args;
+
+    if (t->batch) { // callback of coalesced timers is not registered
+        return false;
+    } else if (t->script) {
+        name = s_scripts[t->cb.script];
+    } else {
+        handler_func_map::const_iterator itr = s_func_handlers.find(t->cb.func);
+
+        if (itr == s_func_handlers.end()) {
+            return false;
+        }
+
+        const handler_t *h = itr->second;
+
+        if (t->args != NULL && (h->pack == NULL || !h->pack(t->args, &args))) {
+            return false;
+        }
+        name = h->name;
+    }
+
+    time64_t due = s_mgr.last_time + t->phase + s_mgr.interval
+        * FRAME_DIFFER(t->cursor.a, s_mgr.last_cursor);
+    const std::string &label = s_labels[t->label]->name;
+
+    memset(&r, 0, sizeof(r));
+    r.remain = (long long)(due - now);
+    r.life = t->life;
+    r.mode = t->mode;
+    r.script = t->script;
+    r.manual = t->manual;
+    r.name_len = name.size();
+    r.label_len = (t->label > 0) ? label.size() : 0;
+    r.args_len = args.size();
+    fwrite(&r, sizeof(r), 1, fp);
+    fwrite(name.data(), 1, r.name_len, fp);
+    fwrite(label.data(), 1, r.label_len, fp);
+    fwrite(args.data(), 1, r.args_len, fp);
+    return true;
+}
+
+///
+/// Read timer from snapshot and schedule it.
+/// @param down Time the process has been down(ms).
+/// @return 1 if restored, 0 if dropped, -1 if the file can not be read on.
+///
+static int _load(FILE *fp, int policy, time64_t down, id_list *tids)
+{
+    record_t r;
+
+    if (fread(&r, sizeof(r), 1, fp) != 1
+            || r.args_len < 0 || r.args_len > TIMER_SNAPSHOT_ARGS_MAX) {
+        return -1;
+    }
+
+    std::string name(r.name_len, '\0');
+    std::string label(r.label_len, '\0');
+    std::string args(r.args_len, '\0');
+
+    if ((r.name_len > 0 && fread(&name[0], 1, r.name_len, fp) != r.name_len)
+            || (r.label_len > 0
+                && fread(&label[0], 1, r.label_len, fp) != r.label_len)
+            || (r.args_len > 0
+                && fread(&args[0], 1, r.args_len, fp) != (size_t)r.args_len)) {
+        return -1;
+    }
+    if (r.mode > TIMER_FIXED_DELAY || r.life <= 0
+            || r.life >= (long long)MAX_LIFE
+            || r.remain >= (long long)MAX_LIFE
+            || r.remain <= -(long long)MAX_LIFE) {
+        LOG_WARN("timer", "Invalid record `%s`(%d/%lld/%lld), timer dropped.",
+                name.c_str(), r.mode, r.life, r.remain);
+        return 0;
+    }
+
+    const handler_t *h = NULL;
+
+    if (!r.script) {
+        handler_map::const_iterator itr = s_named_handlers.find(name);
+
+        if (itr == s_named_handlers.end()) {
+            LOG_WARN("timer", "Callback `%s` NOT registered, timer dropped.",
+                    name.c_str());
+            return 0;
+        }
+        h = itr->second;
+        if (r.args_len > 0 && h->unpack == NULL) {
+            return 0;
+        }
+    }
+
+    long long delay = r.remain - (long long)down;
+
+    if (delay < 0) { // expired while down
+        if (r.mode != TIMER_ONCE && policy == TIMER_CATCHUP_DROP) {
+            delay += (-delay + r.life - 1) / r.life * r.life;
+        } else if (policy == TIMER_CATCHUP_DROP) {
+            return 0;
+        } else {
+            delay = 0;
+        }
+    }
+    delay = std::min(std::max(delay, (long long)s_mgr.interval),
+            (long long)MAX_LIFE - 1);
+
+    timer_t *t = _alloc();
+
+    if (t == NULL) {
+        return 0;
+    }
+    t->life = r.life;
+    t->mode = r.mode;
+    t->script = r.script;
+    t->manual = r.manual;
+    t->cancel = false;
+    t->label = _label(label.c_str());
+    if (r.script) {
+        t->cb.script = _intern(name.c_str());
+    } else {
+        t->cb.func = h->func;
+        t->args = (r.args_len > 0) ? h->unpack(args) : NULL;
+    }
+    _start(t, delay);
+    if (tids != NULL) {
+        tids->push_back(t->id);
+    }
+    return 1;
+}
+
 static void _destroy(timer_t *t)
 {
     if (t) {
-        s_timers.erase(t->id);
-        if (!t->manual) {
+        int gen = TIMER_GEN(t->id);
+
+        if (t->batch) {
+            batch_t *b = (batch_t *)t->args;
+            batch_map::iterator itr = s_batches.find(batch_key(t->cursor.a,
+                        t->cb.batch));
+
+            if (itr != s_batches.end() && itr->second == t) {
+                s_batches.erase(itr);
+            }
+            for (size_t i = b->offset; !t->manual && i < b->args.size(); ++i) {
+                E_FREE(b->args[i]); // not handled
+            }
+            E_DELETE(b);
+        } else if (!t->manual) {
             E_FREE(t->args);
         }
-        S_DELETE(t);
+        // stale handles of the node are rejected
+        gen = (gen < 0x7fffffff) ? gen + 1 : 1;
+
+        spin lock(&s_pool_lock);
+
+        t->id = TIMER_HANDLE(gen, TIMER_INDEX(t->id));
+        t->next = s_free_nodes;
+        s_free_nodes = t;
+        --s_node_used;
     }
 }
 
@@ -432,16 +1581,49 @@ static void _bingo(void)
     }
 }
 
+///
+/// Get the number of empty frames could be skipped, without crossing the
+/// end of wheel 0 (rehashing).
+///
+static int _skip(int frame)
+{
+    int cur = CURRENT_WHEEL_CURSOR;
+    int next = std::min(_next_occupied(cur), WHEEL_SET_SIZE0 - 1);
+
+    return std::min(next - cur, frame);
+}
+
+///
+/// Find the first non-empty bucket of wheel 0 from given one.
+/// @return Bucket index, WHEEL_SET_SIZE0 if not found.
+///
+static int _next_occupied(int from)
+{
+    int w = from >> 6;
+    uint64_t bits = s_mgr.occupied[w] & (~0ULL << (from & 63));
+
+    while (bits == 0) {
+        if (++w >= WHEEL_SET_SIZE0 / 64) {
+            return WHEEL_SET_SIZE0;
+        }
+        bits = s_mgr.occupied[w];
+    }
+    return (w << 6) + __builtin_ctzll(bits);
+}
+
 static void _rehash(int bucket)
 {
     timer_t *head = s_mgr.timers[bucket];
     s_mgr.timers[bucket] = NULL;
+    OCCUPIED_CLR(bucket);
     timer_t *t = head;
 
+    ++s_mgr.rehash_num;
     while (t != NULL) {
         timer_t *n = t->next;
 
         _schedule(t);
+        ++s_mgr.rehash_moved;
         if (n == head) {
             break;
         }
@@ -449,16 +1631,27 @@ static void _rehash(int bucket)
     }
 }
 
+///
+/// Get delay to the next wall-clock minute, one missed minute is caught up
+/// at once, more are skipped as the clock may have jumped.
+///
+static time64_t _min_delay(void)
+{
+    time64_t now = time_ms();
+
+    s_min_due += 60000;
+    if (s_min_due + 60000 <= now || s_min_due > now + 120000) {
+        s_min_due = (now / 60000 + 1) * 60000;
+    }
+    return (s_min_due > now) ? s_min_due - now : 1; // not called in place
+}
+
 static bool _timer_min(void *args)
 {
     time_t cur = time_s();
-    time64_t tm_timer;
-    struct tm tm_cur;
-
-    localtime_r(&cur, &tm_cur);
-    tm_timer = (60 - tm_cur.tm_sec) * 1000llu;
-    timer_add(tm_timer, _timer_min, NULL, true);
 
+    // re-aligned with wall clock each time, not drifting with monotonic
+    timer_add(_min_delay(), _timer_min, NULL, true);
     handler_list::const_iterator itr = s_handlers.begin();
 
     for (; itr != s_handlers.end(); ++itr) {
@@ -9,7 +9,11 @@
  * @date 2011-01-10
  *
  * There is a slot storing timers won't be expired.
- * It is NOT multi-thread safe.
+ * timer_add/timer_cancel may be called in any thread, submitted and applied
+ * by the next timer_run, callbacks are always called by timer_run. Others
+ * are NOT multi-thread safe, called in the thread calling timer_init.
+ * Timers are driven by the monotonic clock(time_mono), and timer_run
+ * refreshes the cached frame time(time_update) each frame.
  */
 
 
@@ -23,26 +27,118 @@
 #include <elf/config.h>
 #include <elf/oid.h>
 #include <elf/time.h>
+#include <string>
+
+#define TIMER_HIST_SIZE                 24 // log2 buckets
 
 namespace elf {
+///
+/// Pack args of timer into snapshot.
+/// @param args Callback arguments.
+/// @param out Packed args.
+/// @return false if not serialisable, the timer is not saved.
+///
+typedef bool (*timer_pack)(void *args, std::string *out);
+
+///
+/// Unpack args of timer from snapshot.
+/// @param in Packed args.
+/// @return Callback arguments, allocated by E_ALLOC if not manual.
+///
+typedef void *(*timer_unpack)(const std::string &in);
+
+///
+/// Callback of coalesced timers.
+/// @param args Args of timers.
+/// @param num Number of args.
+///
+typedef void (*batch_callback)(void **args, int num);
+
+enum timer_catchup {
+    TIMER_CATCHUP_FIRE = 0, // expire timers expired while down at once
+    TIMER_CATCHUP_DROP, // drop them, repeating timers wait the next period
+};
+
+enum timer_mode {
+    TIMER_ONCE = 0,
+    TIMER_FIXED_RATE, // period counts from the expected expiry
+    TIMER_FIXED_DELAY, // period counts from the end of callback
+};
+
+// timer totals and cascading counters
+struct timer_counter_t {
+    int total; // total number of timers
+    int remain; // remain timers
+    int passed; // total number of passed timers
+    int cancelled; // total number of cancelled timers
+    int rehash_num; // number of cascaded buckets
+    int rehash_moved; // number of timers moved by cascading
+};
+
+// profile of timers with the same label
+struct timer_label_t {
+    int fired; // number of callbacks
+    time64_t cost; // total callback time(us)
+    time64_t cost_max; // (us)
+    long long late_max; // (ms)
+    int costs[TIMER_HIST_SIZE]; // log2 histogram of callback time(us)
+    int lates[TIMER_HIST_SIZE]; // log2 histogram of lateness(ms)
+};
+
 int timer_init(void);
 int timer_fini(void);
 
 void timer_run(void);
+
+///
+/// Log timer totals and cascading counters, with lateness(actual vs
+/// scheduled time) and callback time of each label if profiling.
+///
 void timer_stat(void);
 
+///
+/// Enable/Disable profiling lateness and callback time of timers, grouped
+/// by label in log2 histograms.
+/// @param enable Enable or not.
+///
+void timer_profile(bool enable);
+
+///
+/// Get timer totals and cascading counters.
+/// @param[out] counter Counters.
+///
+void timer_counter(timer_counter_t *counter);
+
+///
+/// Get profile of timers with the same label, bucket i of histograms
+/// counts [2^(i-1), 2^i), bucket 0 counts values less than 1.
+/// @param[in] label Label of the timer kind, NULL for unlabeled timers.
+/// @param[out] prof Profile.
+/// @return false if the label is unknown.
+///
+bool timer_profile(const char *label, timer_label_t *prof);
+
 ///
 /// Return size of remain timers.
 ///
 int timer_size(void);
 
+///
+/// Get time to the next frame with timers expiring, for sleeping in the
+/// main loop(e.g. timeout of epoll_wait).
+/// @return Milliseconds, 0 if due now, -1 if no timers.
+///
+int timer_next_deadline(void);
+
 ///
 /// Create a new timer.
 /// @param life Life time of the timer(ms).
 /// @param func Script function name bound to the timer.
-/// @return id of the timer.
+/// @param label Label of the timer kind, profiled separately.
+/// @return id(handle) of the timer, OID_NIL if failed.
 ///
-const oid_t &timer_add(time64_t life, const char *func);
+const oid_t &timer_add(time64_t life, const char *func,
+        const char *label = NULL);
 
 ///
 /// Create a new timer.
@@ -50,9 +146,42 @@ const oid_t &timer_add(time64_t life, const char *func);
 /// @param func Callback function.
 /// @param args Callback arguments.
 /// @param manual Manual destroy args.
-/// @return id of the timer.
+/// @param label Label of the timer kind, profiled separately.
+/// @return id(handle) of the timer, OID_NIL if failed or expired at once.
 ///
-const oid_t &timer_add(time64_t life, callback func, void *args, bool manual);
+const oid_t &timer_add(time64_t life, callback func, void *args, bool manual,
+        const char *label = NULL);
+
+///
+/// Create a repeating timer, rescheduled in place until cancelled or the
+/// callback returns false.
+/// @param delay Delay of the first expiry(ms).
+/// @param period Period(ms).
+/// @param func Callback function.
+/// @param args Callback arguments, shared by all periods.
+/// @param manual Manual destroy args.
+/// @param mode TIMER_FIXED_RATE or TIMER_FIXED_DELAY.
+/// @param label Label of the timer kind, profiled separately.
+/// @return id(handle) of the timer, kept for all periods.
+///
+const oid_t &timer_repeat(time64_t delay, time64_t period,
+        callback func, void *args, bool manual, int mode,
+        const char *label = NULL);
+
+///
+/// Create a coalesced timer, timers with the same callback expiring in the
+/// same frame share one node, and the callback is called once with all
+/// args. In the thread calling timer_init only.
+/// @param life Life time of the timer(ms).
+/// @param func Batch callback function.
+/// @param args Callback arguments, appended to the batch.
+/// @param manual Manual destroy args, the same for timers of the callback.
+/// @param budget Max args per call, the rest are handled in the next
+/// frames. 0 if unlimited.
+/// @return id(handle) of the shared node, cancelling it cancels the batch.
+///
+const oid_t &timer_batch(time64_t life, batch_callback func, void *args,
+        bool manual, int budget = 0);
 
 ///
 /// Add cycle timer, period of one minte.
@@ -61,7 +190,8 @@ const oid_t &timer_add(time64_t life, callback func, void *args, bool manual);
 void timer_cycle(callback func);
 
 ///
-/// Cancel timer with given tid.
+/// Cancel timer with given tid, released at once(O(1)). Ids of expired
+/// or cancelled timers are ignored.
 /// @param tid Timer identification.
 ///
 void timer_cancel(const oid_t &tid);
@@ -91,9 +221,60 @@ void timer_pause(const oid_t &tid);
 void timer_resume(const oid_t &tid);
 
 ///
-/// Set timer interval for running timers.
+/// Enable high resolution mode, the next deadline is armed on a timerfd
+/// (CLOCK_MONOTONIC). Register it(EPOLLIN) in the epoll set of the main
+/// loop and call timer_run once it is readable.
+/// @param interval Frame interval(ms), 1 for fine-grained timers.
+/// @return The timerfd, -1 if failed.
+///
+int timer_hires(time64_t interval);
+
+///
+/// Leave high resolution mode, close the timerfd and restore the frame
+/// interval set before timer_hires.
+///
+void timer_lowres(void);
+
+///
+/// Get timerfd of high resolution mode.
+/// @return The timerfd, -1 if not enabled.
+///
+int timer_fd(void);
+
+///
+/// Register callback by name, timers of it could be saved into snapshot
+/// and restored by another process. Timers of unregistered callbacks are
+/// not saved.
+/// @param name Unique name of the callback.
+/// @param func Callback function.
+/// @param pack Args packer, NULL if args are always NULL.
+/// @param unpack Args unpacker, NULL if args are always NULL.
+/// @return 0 if succeeded, -1 if registered already.
+///
+int timer_regist(const char *name, callback func,
+        timer_pack pack = NULL, timer_unpack unpack = NULL);
+
+///
+/// Save all pending timers into snapshot file, as remaining life,
+/// callback name and packed args.
+/// @param path Snapshot file path, written atomically.
+/// @return Number of saved timers, -1 if failed.
+///
+int timer_save(const char *path);
+
+///
+/// Restore timers from snapshot file, after callbacks registered.
+/// @param path Snapshot file path.
+/// @param policy timer_catchup, for timers expired while down.
+/// @param[out] tids Ids of restored timers, optional.
+/// @return Number of restored timers, -1 if failed.
+///
+int timer_load(const char *path, int policy, id_list *tids = NULL);
+
+///
+/// Set timer interval for running timers, pending timers keep their
+/// deadlines.
 /// @param t The value of timer interval.
-/// For test only.
 ///
 void timer_interval(time64_t t);
 
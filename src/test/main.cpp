@@ -5,6 +5,7 @@
 
 #include <elf/elf.h>
 #include <elf/db.h>
+#include <elf/event.h>
 #include <elf/net/net.h>
 #include <elf/script/script.h>
 #include <elf/timer.h>
@@ -65,6 +66,7 @@ int main(int argc, char **argv)
     BEGIN_CRASH_DUMP {
         ELF_INIT(log);
         ELF_INIT(timer);
+        ELF_INIT(event);
         ELF_INIT(db);
         ELF_INIT(script);
         ELF_INIT(net);
@@ -76,6 +78,7 @@ int main(int argc, char **argv)
         ELF_FINI(net);
         ELF_FINI(script);
         ELF_FINI(db);
+        ELF_FINI(event);
         ELF_FINI(timer);
         ELF_FINI(log);
         exit(EXIT_SUCCESS);
@@ -0,0 +1,401 @@
+/*
+ * Copyright (C) 2014 Yule Fox. All rights reserved.
+ * http://www.yulefox.com/
+ */
+
+#include <elf/elf.h>
+#include <elf/event.h>
+#include <tut/tut.hpp>
+#include <pthread.h>
+#include <string.h>
+
+#define EVENT_MAX           64
+#define PRODUCER_NUM        4
+#define PRODUCER_EMITS      10000 // over the ingress ring, spilled
+
+struct record_t {
+    int num;
+    int evt;
+    int arg_a;
+    int arg_b;
+    elf::oid_t tid;
+};
+
+static record_t s_records[EVENT_MAX];
+
+static bool on_event(void *args) {
+    elf::callback_t *cb = (elf::callback_t *)args;
+    record_t &r = s_records[cb->lid];
+
+    ++r.num;
+    r.evt = cb->evt;
+    r.arg_a = cb->targ_a;
+    r.arg_b = cb->targ_b;
+    r.tid = cb->tid;
+    return true;
+}
+
+static bool on_unregist(void *args) {
+    elf::callback_t *cb = (elf::callback_t *)args;
+
+    elf::event_unregist(cb->oid, cb->lid);
+    return on_event(args);
+}
+
+static elf::callback_t *listener(elf::oid_t oid, elf::oid_t lid,
+        elf::callback func = on_event) {
+    elf::callback_t *cb = (elf::callback_t *)E_ALLOC(sizeof(*cb));
+
+    memset(cb, 0, sizeof(*cb));
+    cb->oid = oid;
+    cb->lid = lid;
+    cb->func = func;
+    return cb;
+}
+
+static int s_seqs[PRODUCER_NUM]; // next sequence expected
+static int s_disorders;
+
+static bool on_order(void *args) {
+    elf::callback_t *cb = (elf::callback_t *)args;
+
+    if (cb->targ_b != s_seqs[cb->targ_a]++) {
+        ++s_disorders;
+    }
+    return true;
+}
+
+static void *produce(void *args) {
+    int idx = (int)(intptr_t)args;
+
+    for (int i = 0; i < PRODUCER_EMITS; ++i) {
+        if (i % 1000 == 999) { // in bursts, across frames
+            usleep(100);
+        }
+        elf::event_emit(30, idx, i, 7);
+    }
+    return NULL;
+}
+
+static void reset(void) {
+    memset(s_records, 0, sizeof(s_records));
+}
+
+namespace tut {
+struct event {
+    event() {
+        reset();
+    }
+
+    ~event() {
+    }
+};
+
+typedef test_group<event> factory;
+typedef factory::object object;
+
+static tut::factory tf("event");
+
+template<>
+template<>
+void object::test<1>() {
+    set_test_name("Regist");
+
+    elf::event_regist(1, listener(1, 1));
+    elf::event_regist(1, listener(2, 2));
+    elf::event_regist(2, listener(1, 3));
+    elf::event_emit(1, 5, 6, 1);
+    elf::event_proc();
+    ensure_equals(s_records[1].num, 1);
+    ensure_equals(s_records[1].arg_a, 5);
+    ensure_equals(s_records[1].arg_b, 6);
+    ensure_equals(s_records[1].tid, 1);
+    ensure_equals(s_records[2].num, 0);
+    ensure_equals(s_records[3].num, 0);
+    elf::event_unregist(1);
+    elf::event_unregist(2);
+    elf::event_proc();
+}
+
+template<>
+template<>
+void object::test<2>() {
+    set_test_name("Unregist");
+
+    elf::event_regist(1, listener(3, 1));
+    elf::event_regist(2, listener(3, 1));
+    elf::event_regist(1, listener(3, 2));
+    elf::event_regist(2, listener(3, 2));
+    elf::event_unregist(3, 1, 1); // by evt and lid
+    elf::event_emit(1, 0, 0, 3);
+    elf::event_emit(2, 0, 0, 3);
+    elf::event_proc();
+    ensure_equals(s_records[1].num, 1);
+    ensure_equals(s_records[2].num, 2);
+
+    reset();
+    elf::event_unregist(3, 2); // by lid
+    elf::event_emit(1, 0, 0, 3);
+    elf::event_emit(2, 0, 0, 3);
+    elf::event_proc();
+    ensure_equals(s_records[1].num, 1);
+    ensure_equals(s_records[2].num, 0);
+
+    reset();
+    elf::event_unregist(3); // by oid
+    elf::event_emit(2, 0, 0, 3);
+    elf::event_proc();
+    ensure_equals(s_records[1].num, 0);
+}
+
+template<>
+template<>
+void object::test<3>() {
+    set_test_name("Compact");
+
+    for (int i = 1; i < EVENT_MAX; ++i) {
+        elf::event_regist(3, listener(4, i));
+    }
+    for (int i = 2; i < EVENT_MAX; i += 2) {
+        elf::event_unregist(4, i, 3);
+    }
+    elf::event_proc(); // tombstones removed
+    elf::event_emit(3, 0, 0, 4);
+    elf::event_proc();
+    for (int i = 1; i < EVENT_MAX; ++i) {
+        ensure_equals(s_records[i].num, i % 2);
+    }
+
+    reset();
+    for (int i = 2; i < EVENT_MAX; i += 2) {
+        elf::event_regist(3, listener(4, i));
+    }
+    elf::event_emit(3, 0, 0, 4);
+    elf::event_proc();
+    for (int i = 1; i < EVENT_MAX; ++i) {
+        ensure_equals(s_records[i].num, 1);
+    }
+
+    // unregisted by itself, emissions queued before it are still delivered
+    reset();
+    elf::event_unregist(4);
+    elf::event_regist(3, listener(4, 1, on_unregist));
+    elf::event_regist(3, listener(4, 2));
+    elf::event_emit(3, 0, 0, 4);
+    elf::event_emit(3, 0, 0, 4);
+    elf::event_proc();
+    elf::event_emit(3, 0, 0, 4);
+    elf::event_proc();
+    ensure_equals(s_records[1].num, 2);
+    ensure_equals(s_records[2].num, 3);
+    elf::event_unregist(4);
+    elf::event_proc();
+}
+
+template<>
+template<>
+void object::test<4>() {
+    set_test_name("Any");
+
+    elf::event_regist_any(4, listener(elf::OID_NIL, 1));
+    elf::event_regist_range(5, 7, listener(elf::OID_NIL, 2));
+    elf::event_emit(4, 1, 0, 100);
+    elf::event_emit(4, 2, 0, 200);
+    for (int evt = 5; evt <= 8; ++evt) {
+        elf::event_emit(evt, evt, 0, 100);
+    }
+    elf::event_proc();
+    ensure_equals(s_records[1].num, 2);
+    ensure_equals(s_records[1].tid, 200);
+    ensure_equals(s_records[2].num, 3);
+    ensure_equals(s_records[2].evt, 7);
+    ensure_equals(s_records[2].arg_a, 7);
+
+    reset();
+    elf::event_unregist_any(2, 6);
+    elf::event_emit(6, 0, 0, 100);
+    elf::event_emit(5, 0, 0, 100);
+    elf::event_proc();
+    ensure_equals(s_records[2].num, 1);
+
+    reset();
+    elf::event_unregist_any(elf::OID_NIL);
+    elf::event_emit(4, 0, 0, 100);
+    elf::event_emit(5, 0, 0, 100);
+    elf::event_proc();
+    ensure_equals(s_records[1].num, 0);
+    ensure_equals(s_records[2].num, 0);
+}
+
+template<>
+template<>
+void object::test<5>() {
+    set_test_name("Coalesce");
+
+    int policies[] = {
+        elf::EVENT_COALESCE_NONE,
+        elf::EVENT_COALESCE_LAST,
+        elf::EVENT_COALESCE_SUM,
+        elf::EVENT_COALESCE_ONCE,
+    };
+
+    for (int i = 0; i < 4; ++i) {
+        elf::event_regist(10 + i, listener(5, 1 + i));
+        elf::event_coalesce(10 + i, policies[i]);
+    }
+    elf::event_proc();
+    for (int n = 1; n <= 10; ++n) {
+        for (int i = 0; i < 4; ++i) {
+            elf::event_emit(10 + i, n, 2 * n, 5);
+        }
+    }
+    elf::event_proc();
+    ensure_equals(s_records[1].num, 10);
+    ensure_equals(s_records[1].arg_a, 10);
+    ensure_equals(s_records[2].num, 1);
+    ensure_equals(s_records[2].arg_a, 10);
+    ensure_equals(s_records[2].arg_b, 20);
+    ensure_equals(s_records[3].num, 1);
+    ensure_equals(s_records[3].arg_a, 55);
+    ensure_equals(s_records[3].arg_b, 110);
+    ensure_equals(s_records[4].num, 1);
+    ensure_equals(s_records[4].arg_a, 1);
+    ensure_equals(s_records[4].arg_b, 2);
+    for (int i = 0; i < 4; ++i) {
+        elf::event_coalesce(10 + i, elf::EVENT_COALESCE_NONE);
+    }
+    elf::event_unregist(5);
+    elf::event_proc();
+}
+
+template<>
+template<>
+void object::test<6>() {
+    set_test_name("Stat");
+
+    elf::event_profile(1);
+    elf::event_regist(20, listener(6, 1));
+    for (int i = 0; i < 100; ++i) {
+        elf::event_emit(20, i, 0, 6);
+    }
+    elf::event_proc();
+    elf::event_stat();
+    elf::event_profile(0);
+    ensure_equals(s_records[1].num, 100);
+    elf::event_unregist(6);
+    elf::event_proc();
+}
+
+template<>
+template<>
+void object::test<7>() {
+    set_test_name("Ingress");
+
+    elf::event_regist(30, listener(7, 1, on_order));
+    elf::event_proc();
+    for (int round = 0; round < 2; ++round) { // ingresses freed on exit
+        pthread_t tids[PRODUCER_NUM]; // joinable, exited before draining
+        int frames = 0;
+
+        memset(s_seqs, 0, sizeof(s_seqs));
+        for (int i = 0; i < PRODUCER_NUM; ++i) {
+            pthread_create(tids + i, NULL, produce, (void *)(intptr_t)i);
+        }
+        for (int i = 0; i < PRODUCER_NUM; ++i) {
+            pthread_join(tids[i], NULL);
+        }
+        for (; frames < 100; ++frames) {
+            int sum = 0;
+
+            elf::event_proc();
+            for (int i = 0; i < PRODUCER_NUM; ++i) {
+                sum += s_seqs[i];
+            }
+            if (sum == PRODUCER_NUM * PRODUCER_EMITS) {
+                break;
+            }
+        }
+        ensure(frames > 1); // drained in bounded batches
+        ensure_equals(s_disorders, 0);
+        for (int i = 0; i < PRODUCER_NUM; ++i) {
+            ensure_equals(s_seqs[i], PRODUCER_EMITS);
+        }
+    }
+    elf::event_unregist(7);
+    elf::event_proc();
+}
+
+template<>
+template<>
+void object::test<8>() {
+    set_test_name("Ingress concurrent");
+
+    elf::event_regist(30, listener(7, 1, on_order));
+    elf::event_proc();
+    for (int round = 0; round < 8; ++round) { // drained while producing
+        pthread_t tids[PRODUCER_NUM];
+        elf::time64_t st = elf::time_ms();
+        int sum = 0;
+
+        memset(s_seqs, 0, sizeof(s_seqs));
+        for (int i = 0; i < PRODUCER_NUM; ++i) {
+            pthread_create(tids + i, NULL, produce, (void *)(intptr_t)i);
+        }
+        while (sum < PRODUCER_NUM * PRODUCER_EMITS
+                && elf::time_diff(elf::time_ms(), st) < 5000) {
+            elf::event_proc();
+            sum = 0;
+            for (int i = 0; i < PRODUCER_NUM; ++i) {
+                sum += s_seqs[i];
+            }
+        }
+        for (int i = 0; i < PRODUCER_NUM; ++i) {
+            pthread_join(tids[i], NULL);
+        }
+        ensure_equals(s_disorders, 0);
+        for (int i = 0; i < PRODUCER_NUM; ++i) {
+            ensure_equals(s_seqs[i], PRODUCER_EMITS);
+        }
+    }
+    elf::event_unregist(7);
+    elf::event_proc();
+}
+
+template<>
+template<>
+void object::test<9>() {
+    set_test_name("Coalesce fence");
+
+    elf::event_coalesce(14, elf::EVENT_COALESCE_LAST);
+    elf::event_regist(14, listener(9, 1));
+    elf::event_proc();
+
+    // delivered to the listener before unregisted
+    elf::event_emit(14, 1, 0, 9);
+    elf::event_unregist(9, 1, 14);
+    elf::event_emit(14, 2, 0, 9);
+    elf::event_proc();
+    ensure_equals(s_records[1].num, 1);
+    ensure_equals(s_records[1].arg_a, 1);
+
+    // merged on each side of the regist
+    reset();
+    elf::event_emit(14, 1, 0, 9);
+    elf::event_emit(14, 2, 0, 9);
+    elf::event_regist(14, listener(9, 2));
+    elf::event_emit(14, 3, 0, 9);
+    elf::event_emit(14, 4, 0, 9);
+    elf::event_proc();
+    ensure_equals(s_records[2].num, 1);
+    ensure_equals(s_records[2].arg_a, 4);
+    elf::event_coalesce(14, elf::EVENT_COALESCE_NONE);
+    elf::event_unregist(9);
+    elf::event_proc();
+}
+
+template<>
+template<>
+void object::test<20>() {
+    set_test_name("End");
+}
+}
@@ -0,0 +1,348 @@
+/*
+ * Copyright (C) 2014 Yule Fox. All rights reserved.
+ * http://www.yulefox.com/
+ */
+
+#include <elf/elf.h>
+#include <elf/object.h>
+#include <google/protobuf/descriptor.pb.h>
+#include <tut/tut.hpp>
+
+using google::protobuf::DescriptorProto;
+
+typedef elf::OIDMap<int> int_map;
+
+///
+/// Find ids with given home slot of a map with given capacity.
+///
+static void home_ids(int home, int cap, int num, elf::oid_t *ids)
+{
+    elf::oid_t id = 1;
+
+    for (int i = 0; i < num; ++id) {
+        if ((int)(int_map::Hash(id) & (cap - 1)) == home) {
+            ids[i++] = id;
+        }
+    }
+}
+
+///
+/// Over-aligned type from the pool.
+///
+struct wide {
+    OBJECT_POOL(wide)
+
+    char data[24];
+} __attribute__((aligned(64)));
+
+///
+/// Object holding a pb created by E_NEW.
+///
+struct entity : public elf::Object {
+    entity(elf::oid_t id) : elf::Object(id) {
+        m_pb = E_NEW DescriptorProto;
+        OnInit();
+    }
+};
+
+namespace tut {
+struct objects {
+    objects() {
+    }
+
+    ~objects() {
+    }
+};
+
+typedef test_group<objects> factory;
+typedef factory::object object;
+
+static tut::factory tf("object");
+
+template<>
+template<>
+void object::test<1>() {
+    set_test_name("OIDMap");
+
+    int_map m;
+
+    ensure_equals(m.Find(1), 0);
+    ensure(!m.Erase(1));
+    m.Insert(1, 10);
+    m.Insert(2, 20);
+    m.Insert(1, 11); // replaced
+    ensure_equals(m.Size(), 2);
+    ensure_equals(m.Find(1), 11);
+    ensure_equals(m.Find(2), 20);
+    ensure_equals(m.Find(3), 0);
+    ensure(m.Erase(1));
+    ensure(!m.Erase(1));
+    ensure_equals(m.Size(), 1);
+    ensure_equals(m.KeyAt(0), 2); // the last moved into the hole
+    ensure_equals(m.ValueAt(0), 20);
+}
+
+template<>
+template<>
+void object::test<2>() {
+    set_test_name("OIDMap wrapped");
+
+    int_map m;
+    elf::oid_t ids[4];
+
+    m.Insert(0, -1);
+
+    int cap = m.Capacity();
+
+    // probe run of the last slot wrapped to slots 0, 1, 2
+    home_ids(cap - 1, cap, 3, ids);
+    home_ids(0, cap, 1, ids + 3);
+    m.Erase(0);
+    for (int i = 0; i < 4; ++i) {
+        m.Insert(ids[i], i + 1);
+    }
+    ensure_equals(m.Capacity(), cap);
+    ensure(m.Erase(ids[0]));
+    for (int i = 1; i < 4; ++i) {
+        ensure_equals(m.Find(ids[i]), i + 1);
+    }
+    ensure_equals(m.Find(ids[0]), 0);
+    ensure(m.Erase(ids[2]));
+    ensure_equals(m.Find(ids[1]), 2);
+    ensure_equals(m.Find(ids[3]), 4);
+    m.Insert(ids[0], 5);
+    ensure_equals(m.Find(ids[0]), 5);
+    ensure_equals(m.Find(ids[2]), 0);
+    ensure_equals(m.Size(), 3);
+}
+
+template<>
+template<>
+void object::test<3>() {
+    set_test_name("OIDMap rehash");
+
+    int_map m;
+    const int num = 1000;
+
+    for (int i = 0; i < num; ++i) {
+        m.Insert(i * 7919 + 1, i);
+    }
+    ensure_equals(m.Size(), num);
+    ensure(m.Capacity() * 3 >= num * 4);
+    for (int i = 0; i < num; ++i) {
+        ensure_equals(m.Find(i * 7919 + 1), i);
+    }
+    for (int i = 0; i < num; i += 2) {
+        ensure(m.Erase(i * 7919 + 1));
+    }
+    ensure_equals(m.Size(), num / 2);
+    for (int i = 0; i < num; ++i) {
+        ensure_equals(m.Find(i * 7919 + 1), (i % 2) ? i : 0);
+    }
+    for (int i = 0; i < m.Size(); ++i) {
+        ensure_equals(m.Find(m.KeyAt(i)), m.ValueAt(i));
+    }
+}
+
+template<>
+template<>
+void object::test<4>() {
+    set_test_name("OIDMap clear");
+
+    int_map m;
+
+    for (int i = 1; i <= 100; ++i) {
+        m.Insert(i, i);
+    }
+
+    int cap = m.Capacity();
+
+    m.Clear();
+    ensure_equals(m.Size(), 0);
+    ensure_equals(m.Capacity(), cap); // slots kept
+    ensure_equals(m.Find(1), 0);
+    m.Insert(1, 2);
+    ensure_equals(m.Find(1), 2);
+    ensure_equals(m.Size(), 1);
+}
+
+template<>
+template<>
+void object::test<5>() {
+    set_test_name("Pool aligned");
+
+    elf::ObjectPool<wide> &pool = elf::ObjectPool<wide>::Instance();
+    const int num = 100;
+    wide *objs[num];
+    int used = pool.Used();
+
+    for (int i = 0; i < num; ++i) {
+        objs[i] = E_NEW wide;
+        ensure_equals((size_t)objs[i] % 64, (size_t)0);
+    }
+    ensure_equals(pool.Used(), used + num);
+    ensure(pool.Capacity() >= pool.Used());
+    for (int i = 0; i < num; ++i) {
+        E_DELETE objs[i];
+    }
+    ensure_equals(pool.Used(), used);
+}
+
+template<>
+template<>
+void object::test<6>() {
+    set_test_name("Pool reused");
+
+    typedef elf::ObjectPool<DescriptorProto> proto_pool;
+
+    proto_pool &pool = proto_pool::Instance();
+    DescriptorProto src;
+
+    src.set_name("fox");
+
+    DescriptorProto *a = pool.Clone(src);
+    int cap = pool.Capacity();
+
+    ensure_equals(a->name(), "fox");
+    ensure_equals(pool.Used(), 1);
+    proto_pool::Release(a);
+    ensure_equals(pool.Used(), 0);
+
+    DescriptorProto *b = pool.Clone(src);
+
+    ensure(a == b); // last freed first
+    ensure_equals(pool.Capacity(), cap);
+    proto_pool::Release(b);
+}
+
+template<>
+template<>
+void object::test<7>() {
+    set_test_name("Object dirty");
+
+    entity *obj = E_NEW entity(101);
+    DescriptorProto *pb = obj->GetPB<DescriptorProto>();
+    DescriptorProto replica;
+    std::string delta;
+    std::string sql;
+
+    pb->set_name("fox");
+    pb->add_field()->set_number(1);
+
+    // net sync does not clear dirty fields of persistence
+    ensure_equals(obj->Delta(&delta), 2);
+    ensure(elf::pb_apply(&replica, delta.data(), delta.size()));
+    ensure_equals(replica.name(), "fox");
+    ensure_equals(replica.field_size(), 1);
+    ensure_equals(obj->Columns(&sql), 1);
+    ensure_equals(sql, "`name`='fox'");
+
+    delta.clear();
+    sql.clear();
+    ensure_equals(obj->Delta(&delta), 0);
+    ensure_equals(obj->Columns(&sql), 0);
+    ensure(delta.empty() && sql.empty());
+
+    // and vice versa
+    pb->set_name("wolf");
+    ensure_equals(obj->Columns(&sql), 1);
+    ensure_equals(sql, "`name`='wolf'");
+    ensure_equals(obj->Delta(&delta), 1);
+    ensure(elf::pb_apply(&replica, delta.data(), delta.size()));
+    ensure_equals(replica.name(), "wolf");
+
+    elf::pb_mask mask;
+
+    pb->set_name("cat");
+    ensure_equals(obj->GetDirty(elf::DIRTY_NET, &mask), 1);
+    obj->ClearDirty(elf::DIRTY_NET, mask);
+    mask.clear();
+    ensure_equals(obj->GetDirty(elf::DIRTY_NET, &mask), 0);
+    ensure_equals(obj->GetDirty(elf::DIRTY_DB, &mask), 1);
+    E_DELETE obj;
+    ensure(elf::Object::FindPB<DescriptorProto>(101) == NULL);
+}
+
+template<>
+template<>
+void object::test<8>() {
+    set_test_name("Snapshot");
+
+    typedef DescriptorProto proto;
+
+    entity *obj = E_NEW entity(102);
+    const entity &reader = *obj;
+
+    obj->GetPB<proto>()->set_name("fox");
+
+    elf::PBSnap *s1 = elf::Object::Snapshot(102);
+    elf::PBSnap *s2 = elf::Object::Snapshot(102);
+    proto copy;
+
+    ensure(s1 == s2); // shared until written
+    ensure_equals(s1->Get<proto>().name(), "fox");
+    ensure_equals(reader.GetPB<proto>().name(), "fox");
+    ensure(elf::Object::ClonePB<proto>(&copy, 102));
+    s2->Release();
+    s2 = elf::Object::Snapshot(102);
+    ensure(s1 == s2); // not by reading
+    s2->Release();
+
+    // written in the same frame
+    obj->GetPB<proto>()->set_name("wolf");
+    s2 = elf::Object::Snapshot(102);
+    ensure(s1 != s2);
+    ensure_equals(s1->Get<proto>().name(), "fox");
+    ensure_equals(s2->Get<proto>().name(), "wolf");
+    s2->Release();
+
+    elf::Object::FindPB<proto>(102)->set_name("cat");
+    s2 = elf::Object::Snapshot(102);
+    ensure_equals(s2->Get<proto>().name(), "cat");
+    s2->Release();
+
+    copy.set_name("dog");
+    elf::Object::AddPB(copy, 102, 1);
+    s2 = elf::Object::Snapshot(102);
+    ensure_equals(s2->Get<proto>().name(), "dog");
+    ensure(obj->GetPB<proto>() == elf::Object::FindPB<proto>(102));
+
+    // written through a pointer kept
+    proto *pb = elf::Object::FindPB<proto>(102);
+    elf::PBSnap *s3 = elf::Object::Snapshot(102);
+
+    pb->set_name("owl");
+    elf::Object::Touch(102);
+
+    elf::PBSnap *s4 = elf::Object::Snapshot(102);
+
+    ensure_equals(s3->Get<proto>().name(), "dog");
+    ensure_equals(s4->Get<proto>().name(), "owl");
+    s2->Release();
+    s3->Release();
+    s4->Release();
+
+    // held after the object is gone
+    E_DELETE obj;
+    ensure(elf::Object::Snapshot(102) == NULL);
+    ensure_equals(s1->Get<proto>().name(), "fox");
+    s1->Release();
+
+    // pooled
+    elf::Object::AddPB(copy, 103, 1);
+    s1 = elf::Object::Snapshot(103);
+    elf::Object::FindPB<proto>(103)->set_name("eel");
+    s2 = elf::Object::Snapshot(103);
+    elf::Object::DelPB(103);
+    ensure_equals(s1->Get<proto>().name(), "dog");
+    ensure_equals(s2->Get<proto>().name(), "eel");
+    s1->Release();
+    s2->Release();
+}
+
+template<>
+template<>
+void object::test<20>() {
+    set_test_name("End");
+}
+}
@@ -0,0 +1,175 @@
+/*
+ * Copyright (C) 2014 Yule Fox. All rights reserved.
+ * http://www.yulefox.com/
+ */
+
+#include <elf/elf.h>
+#include <elf/pb.h>
+#include <google/protobuf/descriptor.pb.h>
+#include <tut/tut.hpp>
+
+using google::protobuf::DescriptorProto;
+using google::protobuf::FieldDescriptorProto;
+
+///
+/// Send changes of pb since shadow to replica, then sync shadow.
+/// @return Number of changed fields.
+///
+static int sync(const elf::pb_t &pb, elf::pb_t *shadow, elf::pb_t *replica)
+{
+    elf::pb_mask mask;
+    std::string delta;
+    int num = elf::pb_diff(pb, *shadow, &mask);
+
+    elf::pb_delta(pb, mask, &delta);
+    if (!elf::pb_apply(replica, delta.data(), delta.size())) {
+        return -1;
+    }
+    elf::pb_copy(shadow, pb, mask);
+    return num;
+}
+
+static bool same(const elf::pb_t &a, const elf::pb_t &b)
+{
+    return a.SerializePartialAsString() == b.SerializePartialAsString();
+}
+
+namespace tut {
+struct pb {
+    DescriptorProto obj;
+    DescriptorProto shadow;
+    DescriptorProto replica;
+
+    pb() {
+        obj.set_name("fox");
+        obj.add_field()->set_number(1);
+        obj.add_field()->set_name("hp");
+        obj.add_reserved_name("mp");
+        obj.mutable_options()->set_deprecated(true);
+    }
+
+    ~pb() {
+    }
+};
+
+typedef test_group<pb> factory;
+typedef factory::object object;
+
+static tut::factory tf("pb");
+
+template<>
+template<>
+void object::test<1>() {
+    set_test_name("Set");
+
+    ensure_equals(sync(obj, &shadow, &replica), 4);
+    ensure(same(obj, replica));
+    ensure(same(obj, shadow));
+    ensure_equals(sync(obj, &shadow, &replica), 0);
+}
+
+template<>
+template<>
+void object::test<2>() {
+    set_test_name("Cleared");
+
+    sync(obj, &shadow, &replica);
+    obj.clear_name();
+    obj.clear_options();
+    obj.clear_reserved_name();
+    ensure_equals(sync(obj, &shadow, &replica), 3);
+    ensure(!replica.has_name());
+    ensure(!replica.has_options());
+    ensure_equals(replica.reserved_name_size(), 0);
+    ensure(same(obj, replica));
+}
+
+template<>
+template<>
+void object::test<3>() {
+    set_test_name("Repeated");
+
+    sync(obj, &shadow, &replica);
+    obj.add_reserved_name("sp");
+    obj.mutable_field(0)->set_number(2);
+    ensure_equals(sync(obj, &shadow, &replica), 2);
+    ensure_equals(replica.field_size(), 2); // replaced, not appended
+    ensure_equals(replica.field(0).number(), 2);
+    ensure_equals(replica.reserved_name_size(), 2);
+    ensure(same(obj, replica));
+
+    obj.mutable_field()->RemoveLast();
+    ensure_equals(sync(obj, &shadow, &replica), 1);
+    ensure_equals(replica.field_size(), 1);
+    ensure(same(obj, replica));
+}
+
+template<>
+template<>
+void object::test<4>() {
+    set_test_name("Nested");
+
+    sync(obj, &shadow, &replica);
+    obj.mutable_options()->set_deprecated(false);
+    obj.mutable_options()->set_map_entry(true);
+    ensure_equals(sync(obj, &shadow, &replica), 1);
+    ensure(replica.options().map_entry());
+    ensure(same(obj, replica));
+
+    obj.mutable_options()->clear_map_entry();
+    ensure_equals(sync(obj, &shadow, &replica), 1);
+    ensure(!replica.options().has_map_entry());
+    ensure(same(obj, replica));
+}
+
+template<>
+template<>
+void object::test<5>() {
+    set_test_name("Broken");
+
+    elf::pb_mask mask;
+    std::string delta;
+
+    sync(obj, &shadow, &replica);
+    obj.set_name("wolf");
+    elf::pb_diff(obj, shadow, &mask);
+    elf::pb_delta(obj, mask, &delta);
+    delta.resize(delta.size() - 1); // string cut
+    ensure(!elf::pb_apply(&replica, delta.data(), delta.size()));
+    ensure_equals(replica.name(), "fox"); // untouched
+    ensure(same(shadow, replica));
+
+    delta = "\xff\xff\xff\xff\x0f";
+    ensure(!elf::pb_apply(&replica, delta.data(), delta.size()));
+    ensure(same(shadow, replica));
+}
+
+template<>
+template<>
+void object::test<6>() {
+    set_test_name("Columns");
+
+    FieldDescriptorProto fd;
+    const google::protobuf::Descriptor *des = fd.GetDescriptor();
+    elf::pb_mask mask;
+    std::string sql;
+
+    fd.set_name(std::string("a'b\"c\\d\ne\rf\0g\032", 14));
+    fd.set_number(-7);
+    fd.set_label(FieldDescriptorProto::LABEL_REPEATED);
+    fd.mutable_options()->set_packed(true);
+    elf::pb_mask_set(&mask, des->FindFieldByName("name")->index());
+    elf::pb_mask_set(&mask, des->FindFieldByName("number")->index());
+    elf::pb_mask_set(&mask, des->FindFieldByName("label")->index());
+    elf::pb_mask_set(&mask, des->FindFieldByName("options")->index());
+    ensure_equals(elf::pb_columns(fd, mask, &sql), 3);
+    ensure_equals(sql, "`name`='a\\'b\\\"c\\\\d\\ne\\rf\\0g\\Z',"
+            "`number`=-7,`label`=3");
+}
+
+template<>
+template<>
+void object::test<20>() {
+    set_test_name("End");
+}
+}
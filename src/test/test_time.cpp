@@ -42,4 +42,22 @@ void object::test<2>() {
     elf::time64_t t2 = elf::time_ms();
     ensure(elf::time_diff(t2, t1) == 1000);
 }
+
+template<>
+template<>
+void object::test<3>() {
+    set_test_name("monotonic time");
+    elf::time64_t t1 = elf::time_update();
+
+    ensure_equals(elf::time_frame_mono(), t1);
+    ensure(elf::time_frame_ms() > 0);
+    usleep(10000);
+    ensure_equals(elf::time_frame_mono(), t1);
+
+    elf::time64_t t2 = elf::time_mono();
+
+    ensure(t2 >= t1 + 10);
+    ensure(elf::time_mono_coarse() + 10 >= t2);
+    ensure(elf::time_update() >= t2);
+}
 }
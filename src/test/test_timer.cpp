@@ -8,6 +8,8 @@
 #include <elf/time.h>
 #include <elf/timer.h>
 #include <tut/tut.hpp>
+#include <poll.h>
+#include <pthread.h>
 
 #define TIMER_MAX_LIFE      20000
 #define TIMER_NUMBER        10
@@ -80,6 +82,295 @@ void object::test<2>() {
 template<>
 template<>
 void object::test<3>() {
+    set_test_name("Cancel");
+    putchar('\n');
+
+    int size = elf::timer_size();
+    elf::oid_t tids[TIMER_NUMBER];
+
+    for (int i = 0; i < TIMER_NUMBER; ++i) {
+        tids[i] = elf::timer_add(rand() % TIMER_MAX_LIFE + 1000,
+                "timer.onTimeout");
+    }
+    ensure_equals(elf::timer_size(), size + TIMER_NUMBER);
+    for (int i = 0; i < TIMER_NUMBER; ++i) {
+        elf::timer_cancel(tids[i]);
+        elf::timer_cancel(tids[i]); // stale id
+    }
+    ensure_equals(elf::timer_size(), size);
+
+    // node reused, the stale id must not cancel the new timer
+    elf::oid_t tid = elf::timer_add(TIMER_MAX_LIFE, "timer.onTimeout");
+
+    elf::timer_cancel(tids[0]);
+    ensure_equals(elf::timer_size(), size + 1);
+    elf::timer_cancel(tid);
+    elf::timer_stat();
+}
+
+static bool on_repeat(void *args) {
+    int *times = (int *)args;
+
+    return ++(*times) < 3;
+}
+
+static bool on_deadline(void *args) {
+    *(elf::time64_t *)args = elf::time_mono();
+    return false;
+}
+
+template<>
+template<>
+void object::test<4>() {
+    set_test_name("Repeat");
+    putchar('\n');
+
+    int size = elf::timer_size();
+    int times = 0;
+    elf::time64_t st = elf::time_ms();
+
+    ensure_equals(elf::timer_repeat(-1, 100, on_repeat, &times, true,
+                elf::TIMER_FIXED_RATE), elf::OID_NIL);
+    ensure_equals(elf::timer_repeat(100, -1, on_repeat, &times, true,
+                elf::TIMER_FIXED_RATE), elf::OID_NIL);
+    ensure_equals(elf::timer_size(), size);
+    elf::timer_profile(true);
+    elf::timer_repeat(100, 100, on_repeat, &times, true,
+            elf::TIMER_FIXED_RATE, "test.repeat");
+    while (times < 3 && elf::time_diff(elf::time_ms(), st) < 2000) {
+        int ms = elf::timer_next_deadline();
+
+        usleep((ms > 0 ? ms : 1) * 1000);
+        elf::timer_run();
+    }
+    ensure_equals(times, 3);
+    ensure_equals(elf::timer_size(), size);
+    elf::timer_stat();
+
+    elf::timer_label_t prof;
+    int lates = 0;
+    int costs = 0;
+
+    ensure(elf::timer_profile("test.repeat", &prof));
+    ensure(!elf::timer_profile("test.none", &prof));
+    ensure_equals(prof.fired, 3);
+    for (int i = 0; i < TIMER_HIST_SIZE; ++i) {
+        lates += prof.lates[i];
+        costs += prof.costs[i];
+    }
+    ensure_equals(lates, 3);
+    ensure_equals(costs, 3);
+    ensure(prof.late_max < 100);
+    ensure(prof.cost * 3 >= prof.cost_max);
+
+    // cascaded from wheel 1 in 1ms frames
+    elf::timer_counter_t last;
+    elf::timer_counter_t cur;
+    elf::time64_t fired = 0;
+
+    elf::timer_counter(&last);
+    elf::timer_interval(1);
+    elf::timer_add(300, on_deadline, &fired, true);
+    st = elf::time_ms();
+    while (fired == 0 && elf::time_diff(elf::time_ms(), st) < 2000) {
+        int ms = elf::timer_next_deadline();
+
+        usleep((ms > 0 ? ms : 1) * 1000);
+        elf::timer_run();
+    }
+    elf::timer_interval(50);
+    elf::timer_counter(&cur);
+    ensure(fired > 0);
+    ensure(cur.rehash_num > last.rehash_num);
+    ensure(cur.rehash_moved > last.rehash_moved);
+    ensure(cur.passed > last.passed);
+}
+
+template<>
+template<>
+void object::test<5>() {
+    set_test_name("Hires");
+    putchar('\n');
+
+    int times = 0;
+    elf::time64_t fired = 0;
+    elf::time64_t st = elf::time_mono();
+
+    // added in 50ms frames, kept its deadline in 1ms frames
+    elf::timer_add(300, on_deadline, &fired, true);
+
+    int fd = elf::timer_hires(1);
+
+    ensure(fd >= 0);
+    ensure_equals(elf::timer_fd(), fd);
+    elf::timer_repeat(5, 5, on_repeat, &times, true,
+            elf::TIMER_FIXED_RATE);
+    while ((times < 3 || fired == 0) && elf::time_mono() - st < 2000) {
+        struct pollfd pfd = {fd, POLLIN, 0};
+
+        if (poll(&pfd, 1, 1000) > 0) {
+            elf::timer_run();
+        }
+    }
+    ensure_equals(times, 3);
+    ensure(fired - st >= 300);
+    ensure(fired - st < 400);
+    elf::timer_stat();
+
+    // added in 1ms frames, kept its deadline in 50ms frames
+    fired = 0;
+    st = elf::time_mono();
+    elf::timer_add(120, on_deadline, &fired, true);
+    elf::timer_lowres();
+    ensure_equals(elf::timer_fd(), -1);
+    while (fired == 0 && elf::time_mono() - st < 2000) {
+        int ms = elf::timer_next_deadline();
+
+        usleep((ms > 0 ? ms : 1) * 1000);
+        elf::timer_run();
+    }
+    ensure(fired - st >= 100);
+    ensure(fired - st < 250);
+}
+
+static bool on_snapshot(void *args) {
+    return false;
+}
+
+template<>
+template<>
+void object::test<6>() {
+    set_test_name("Snapshot");
+    putchar('\n');
+
+    elf::id_list tids;
+
+    elf::timer_regist("test.snapshot", on_snapshot);
+    for (int i = 0; i < TIMER_NUMBER; ++i) {
+        tids.push_back(elf::timer_add(TIMER_MAX_LIFE, on_snapshot, NULL, true));
+    }
+
+    int size = elf::timer_size();
+    int saved = elf::timer_save("timer.snap");
+
+    ensure(saved >= TIMER_NUMBER);
+    ensure_equals(elf::timer_load("timer.snap", elf::TIMER_CATCHUP_DROP,
+                &tids), saved);
+    remove("timer.snap");
+    ensure_equals(elf::timer_size(), size + saved);
+    ensure_equals((int)tids.size(), TIMER_NUMBER + saved);
+    elf::timer_stat();
+
+    elf::id_list::const_iterator itr = tids.begin();
+
+    for (; itr != tids.end(); ++itr) {
+        elf::timer_cancel(*itr);
+    }
+    ensure_equals(elf::timer_size(), size - TIMER_NUMBER);
+}
+
+static void on_batch(void **args, int num) {
+    int *times = (int *)args[0];
+
+    *times += num;
+}
+
+template<>
+template<>
+void object::test<7>() {
+    set_test_name("Batch");
+    putchar('\n');
+
+    int size = elf::timer_size();
+    int times = 0;
+    elf::oid_t tid = elf::timer_batch(100, on_batch, &times, true, 2);
+    elf::time64_t st = elf::time_mono();
+
+    ensure_equals(elf::timer_batch(-1, on_batch, &times, true),
+            elf::OID_NIL);
+
+    for (int i = 1; i < 5; ++i) {
+        ensure_equals(elf::timer_batch(100, on_batch, &times, true, 2), tid);
+    }
+    ensure_equals(elf::timer_size(), size + 1);
+    while (times < 5 && elf::time_mono() - st < 2000) {
+        int ms = elf::timer_next_deadline();
+
+        usleep((ms > 0 ? ms : 1) * 1000);
+        elf::timer_run();
+    }
+    ensure_equals(times, 5);
+    ensure_equals(elf::timer_size(), size);
+}
+
+static bool on_submitted(void *args) {
+    __sync_add_and_fetch((int *)args, 1);
+    return false;
+}
+
+struct submit_t {
+    elf::oid_t kept[TIMER_NUMBER];
+    elf::oid_t cancelled; // cancelled by owner before drained
+    int fired;
+};
+
+static void *submit(void *args) {
+    submit_t *s = (submit_t *)args;
+
+    for (int i = 0; i < TIMER_NUMBER; ++i) {
+        s->kept[i] = elf::timer_add(100, on_submitted, &s->fired, true);
+    }
+
+    // cancel applied after its add
+    elf::oid_t tid = elf::timer_add(100, on_submitted, &s->fired, true);
+
+    elf::timer_cancel(tid);
+    elf::timer_cancel(tid); // stale
+    s->cancelled = elf::timer_add(100, on_submitted, &s->fired, true);
+    return NULL;
+}
+
+template<>
+template<>
+void object::test<8>() {
+    set_test_name("Submit");
+    putchar('\n');
+
+    int size = elf::timer_size();
+    elf::timer_counter_t last;
+    elf::timer_counter_t cur;
+    submit_t s;
+    pthread_t tid;
+
+    elf::timer_counter(&last);
+    memset(&s, 0, sizeof(s));
+    pthread_create(&tid, NULL, submit, &s);
+    pthread_join(tid, NULL);
+    for (int i = 0; i < TIMER_NUMBER; ++i) {
+        ensure(s.kept[i] != elf::OID_NIL);
+    }
+    ensure_equals(elf::timer_size(), size); // not drained
+    ensure_equals(elf::timer_next_deadline(), 0);
+    elf::timer_cancel(s.cancelled);
+    elf::timer_run();
+    elf::timer_counter(&cur);
+    ensure_equals(cur.total, last.total + TIMER_NUMBER + 2);
+    ensure_equals(cur.cancelled, last.cancelled + 2);
+
+    elf::time64_t st = elf::time_mono();
+
+    while (s.fired < TIMER_NUMBER && elf::time_mono() - st < 2000) {
+        int ms = elf::timer_next_deadline();
+
+        usleep((ms > 0 ? ms : 1) * 1000);
+        elf::timer_run();
+    }
+    ensure_equals(s.fired, TIMER_NUMBER);
+}
+
+template<>
+template<>
+void object::test<20>() {
     set_test_name("End");
     putchar('\n');
 }